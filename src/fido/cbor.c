@@ -39,6 +39,48 @@ const uint8_t *cbor_data = NULL;
 size_t cbor_len = 0;
 uint8_t cbor_cmd = 0;
 
+static int cbor_get_info_(const uint8_t *data, size_t len) {
+    (void) data;
+    (void) len;
+    return cbor_get_info();
+}
+
+static int cbor_reset_(const uint8_t *data, size_t len) {
+    (void) data;
+    (void) len;
+    return cbor_reset();
+}
+
+static int cbor_selection_(const uint8_t *data, size_t len) {
+    (void) data;
+    (void) len;
+    return cbor_selection();
+}
+
+static int cbor_get_assertion_(const uint8_t *data, size_t len) {
+    return cbor_get_assertion(data, len, false);
+}
+
+typedef struct cbor_cmd {
+    uint8_t cmd;
+    int (*handler)(const uint8_t *data, size_t len);
+} cbor_cmd_t;
+
+static const cbor_cmd_t cbor_cmds[] = {
+    { CTAP_MAKE_CREDENTIAL, cbor_make_credential },
+    { CTAP_GET_ASSERTION, cbor_get_assertion_ },
+    { CTAP_GET_INFO, cbor_get_info_ },
+    { CTAP_CLIENT_PIN, cbor_client_pin },
+    { CTAP_RESET, cbor_reset_ },
+    { CTAP_GET_NEXT_ASSERTION, cbor_get_next_assertion },
+    { CTAP_CREDENTIAL_MGMT, cbor_cred_mgmt },
+    { 0x41, cbor_cred_mgmt },
+    { CTAP_SELECTION, cbor_selection_ },
+    { CTAP_LARGE_BLOBS, cbor_large_blobs },
+    { CTAP_CONFIG, cbor_config },
+    { 0x00, NULL }
+};
+
 int cbor_parse(uint8_t cmd, const uint8_t *data, size_t len) {
     if (len == 0 && cmd == CTAPHID_CBOR) {
         return CTAP1_ERR_INVALID_LEN;
@@ -48,35 +90,10 @@ int cbor_parse(uint8_t cmd, const uint8_t *data, size_t len) {
     }
     if (cap_supported(CAP_FIDO2)) {
         if (cmd == CTAPHID_CBOR) {
-            if (data[0] == CTAP_MAKE_CREDENTIAL) {
-                return cbor_make_credential(data + 1, len - 1);
-            }
-            if (data[0] == CTAP_GET_INFO) {
-                return cbor_get_info();
-            }
-            else if (data[0] == CTAP_RESET) {
-                return cbor_reset();
-            }
-            else if (data[0] == CTAP_CLIENT_PIN) {
-                return cbor_client_pin(data + 1, len - 1);
-            }
-            else if (data[0] == CTAP_GET_ASSERTION) {
-                return cbor_get_assertion(data + 1, len - 1, false);
-            }
-            else if (data[0] == CTAP_GET_NEXT_ASSERTION) {
-                return cbor_get_next_assertion(data + 1, len - 1);
-            }
-            else if (data[0] == CTAP_SELECTION) {
-                return cbor_selection();
-            }
-            else if (data[0] == CTAP_CREDENTIAL_MGMT || data[0] == 0x41) {
-                return cbor_cred_mgmt(data + 1, len - 1);
-            }
-            else if (data[0] == CTAP_CONFIG) {
-                return cbor_config(data + 1, len - 1);
-            }
-            else if (data[0] == CTAP_LARGE_BLOBS) {
-                return cbor_large_blobs(data + 1, len - 1);
+            for (const cbor_cmd_t *c = cbor_cmds; c->handler; c++) {
+                if (c->cmd == data[0]) {
+                    return c->handler(data + 1, len - 1);
+                }
             }
         }
         else if (cmd == CTAP_VENDOR_CBOR) {
@@ -105,6 +122,8 @@ void cbor_thread(void) {
             break;
         }
         apdu.sw = cbor_parse(cbor_cmd, cbor_data, cbor_len);
+        // A cancel only applies to the request it interrupted
+        cancel_button = false;
         if (apdu.sw == 0) {
             DEBUG_DATA(res_APDU + 1, res_APDU_size);
         }
@@ -132,6 +151,7 @@ int cbor_process(uint8_t last_cmd, const uint8_t *data, size_t len) {
     cbor_data = data;
     cbor_len = len;
     cbor_cmd = last_cmd;
+    cancel_button = false;
     ctap_resp->init.data[0] = 0;
     res_APDU = ctap_resp->init.data + 1;
     res_APDU_size = 0;
@@ -247,3 +267,73 @@ CborError COSE_read_key(CborValue *f, int64_t *kty, int64_t *alg, int64_t *crv,
 err:
     return error;
 }
+
+/*
+ * authData builder. authData is written in the unused tail of the response
+ * buffer and every piece is fed to the signature hash as soon as it is
+ * written: rpIdHash, flags and counter on begin, then attested credential data
+ * and extensions, and finally clientDataHash on end. auth_data_end() then
+ * encodes it with cbor_encode_byte_string(), so the signature input is never
+ * assembled in a separate allocation.
+ *
+ * The tail is at most half of the free room, less the longest byte string
+ * header, so the encoded copy always ends before the tail starts.
+ */
+#define CBOR_BSTR_HDR_MAX 3
+
+int auth_data_begin(auth_data_t *ad, const CborEncoder *encoder, uint8_t *buf, size_t buf_len, const mbedtls_md_info_t *md, const uint8_t *rp_id_hash, uint8_t flags, uint32_t ctr) {
+    size_t used = cbor_encoder_get_buffer_size(encoder, buf);
+    if (used + CBOR_BSTR_HDR_MAX > buf_len) {
+        return PICOKEY_ERR_NO_MEMORY;
+    }
+    ad->len = 0;
+    ad->max = MIN((buf_len - used - CBOR_BSTR_HDR_MAX) / 2, 0xFFFF);
+    ad->data = buf + buf_len - ad->max;
+    int ret = hash_md_starts(&ad->md, md);
+    if (ret == 0) {
+        ret = auth_data_put(ad, rp_id_hash, 32);
+    }
+    if (ret == 0) {
+        uint8_t fc[5] = { flags, (ctr >> 24) & 0xFF, (ctr >> 16) & 0xFF, (ctr >> 8) & 0xFF, ctr & 0xFF };
+        ret = auth_data_put(ad, fc, sizeof(fc));
+    }
+    return ret;
+}
+
+int auth_data_put(auth_data_t *ad, const uint8_t *data, size_t len) {
+    if (ad->max - ad->len < len) {
+        return PICOKEY_ERR_NO_MEMORY;
+    }
+    memcpy(ad->data + ad->len, data, len);
+    ad->len += len;
+    return hash_md_update(&ad->md, data, len);
+}
+
+void auth_data_encoder(auth_data_t *ad, CborEncoder *encoder) {
+    cbor_encoder_init(encoder, ad->data + ad->len, ad->max - ad->len, 0);
+}
+
+int auth_data_encoded(auth_data_t *ad, const CborEncoder *encoder) {
+    size_t len = cbor_encoder_get_buffer_size(encoder, ad->data + ad->len);
+    int ret = hash_md_update(&ad->md, ad->data + ad->len, len);
+    ad->len += len;
+    return ret;
+}
+
+int auth_data_end(auth_data_t *ad, CborEncoder *encoder, const uint8_t *client_data_hash, size_t client_data_hash_len, uint8_t *hash) {
+    int ret = hash_md_update(&ad->md, client_data_hash, client_data_hash_len);
+    if (ret == 0) {
+        ret = hash_md_finish(&ad->md, hash);
+    }
+    hash_md_free(&ad->md);
+    if (ret == 0 && cbor_encode_byte_string(encoder, ad->data, ad->len) != CborNoError) {
+        ret = PICOKEY_ERR_NO_MEMORY;
+    }
+    // The tail is overwritten by whatever is encoded next
+    ad->data = NULL;
+    return ret;
+}
+
+void auth_data_free(auth_data_t *ad) {
+    hash_md_free(&ad->md);
+}
@@ -22,8 +22,7 @@
 #endif
 #include "mbedtls/ecp.h"
 #include "mbedtls/ecdh.h"
-#include "mbedtls/sha256.h"
-#include "mbedtls/hkdf.h"
+#include "hash.h"
 #include "cbor.h"
 #include "ctap.h"
 #include "ctap2_cbor.h"
@@ -124,34 +123,34 @@ int kdf(uint8_t protocol, const mbedtls_mpi *z, uint8_t *sharedSecret) {
         return ret;
     }
     if (protocol == 1) {
-        return mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
-                          buf,
-                          sizeof(buf),
-                          sharedSecret);
+        return hash_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                       buf,
+                       sizeof(buf),
+                       sharedSecret);
     }
     else if (protocol == 2) {
         const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
-        ret = mbedtls_hkdf(md_info,
-                           NULL,
-                           0,
-                           buf,
-                           sizeof(buf),
-                           (uint8_t *) "CTAP2 HMAC key",
-                           14,
-                           sharedSecret,
-                           32);
+        ret = hash_hkdf(md_info,
+                        NULL,
+                        0,
+                        buf,
+                        sizeof(buf),
+                        (uint8_t *) "CTAP2 HMAC key",
+                        14,
+                        sharedSecret,
+                        32);
         if (ret != 0) {
             return ret;
         }
-        return mbedtls_hkdf(md_info,
-                            NULL,
-                            0,
-                            buf,
-                            sizeof(buf),
-                            (uint8_t *) "CTAP2 AES key",
-                            13,
-                            sharedSecret + 32,
-                            32);
+        return hash_hkdf(md_info,
+                         NULL,
+                         0,
+                         buf,
+                         sizeof(buf),
+                         (uint8_t *) "CTAP2 AES key",
+                         13,
+                         sharedSecret + 32,
+                         32);
     }
     return -1;
 }
@@ -216,7 +215,7 @@ int authenticate(uint8_t protocol,
                  uint8_t *sign) {
     uint8_t hmac[32];
     int ret =
-        mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, 32, data, len, hmac);
+        hash_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, 32, data, len, hmac);
     if (ret != 0) {
         return ret;
     }
@@ -236,7 +235,7 @@ int verify(uint8_t protocol, const uint8_t *key, const uint8_t *data, uint16_t l
     uint8_t hmac[32];
     //if (paut.in_use == false)
     //    return -2;
-    int ret = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, 32, data, len, hmac);
+    int ret = hash_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, 32, data, len, hmac);
     if (ret != 0) {
         return ret;
     }
@@ -407,19 +406,15 @@ int cbor_client_pin(const uint8_t *data, size_t len) {
         while (paddedNewPin[pin_len] != 0 && pin_len < sizeof(paddedNewPin)) {
             pin_len++;
         }
-        uint8_t minPin = 4;
-        file_t *ef_minpin = search_by_fid(EF_MINPINLEN, NULL, SPECIFY_EF);
-        if (file_has_data(ef_minpin)) {
-            minPin = *file_get_data(ef_minpin);
-        }
-        if (pin_len < minPin) {
+        if (pin_len < fido_conf.min_pin_len) {
             CBOR_ERROR(CTAP2_ERR_PIN_POLICY_VIOLATION);
         }
         uint8_t hsh[34];
         hsh[0] = MAX_PIN_RETRIES;
         hsh[1] = pin_len;
-        mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), paddedNewPin, pin_len, hsh + 2);
+        hash_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), paddedNewPin, pin_len, hsh + 2);
         file_put_data(ef_pin, hsh, 2 + 16);
+        cbor_get_info_invalidate();
         low_flash_available();
         goto err; //No return
     }
@@ -504,30 +499,19 @@ int cbor_client_pin(const uint8_t *data, size_t len) {
         while (paddedNewPin[pin_len] != 0 && pin_len < sizeof(paddedNewPin)) {
             pin_len++;
         }
-        uint8_t minPin = 4;
-        file_t *ef_minpin = search_by_fid(EF_MINPINLEN, NULL, SPECIFY_EF);
-        if (file_has_data(ef_minpin)) {
-            minPin = *file_get_data(ef_minpin);
-        }
-        if (pin_len < minPin) {
+        if (pin_len < fido_conf.min_pin_len) {
             CBOR_ERROR(CTAP2_ERR_PIN_POLICY_VIOLATION);
         }
         uint8_t hsh[34];
         hsh[0] = MAX_PIN_RETRIES;
         hsh[1] = pin_len;
-        mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), paddedNewPin, pin_len, hsh + 2);
-        if (file_has_data(ef_minpin) && file_get_data(ef_minpin)[1] == 1 &&
+        hash_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), paddedNewPin, pin_len, hsh + 2);
+        if (fido_conf.force_pin_change &&
             memcmp(hsh + 2, file_get_data(ef_pin) + 2, 16) == 0) {
             CBOR_ERROR(CTAP2_ERR_PIN_POLICY_VIOLATION);
         }
         file_put_data(ef_pin, hsh, 2 + 16);
-        if (file_has_data(ef_minpin) && file_get_data(ef_minpin)[1] == 1) {
-            uint8_t *tmpf = (uint8_t *) calloc(1, file_get_size(ef_minpin));
-            memcpy(tmpf, file_get_data(ef_minpin), file_get_size(ef_minpin));
-            tmpf[1] = 0;
-            file_put_data(ef_minpin, tmpf, file_get_size(ef_minpin));
-            free(tmpf);
-        }
+        fido_conf_clear_force_pin_change();
         low_flash_available();
         resetPinUvAuthToken();
         goto err; // No return
@@ -600,8 +584,7 @@ int cbor_client_pin(const uint8_t *data, size_t len) {
         new_pin_mismatches = 0;
         file_put_data(ef_pin, pin_data, sizeof(pin_data));
         low_flash_available();
-        file_t *ef_minpin = search_by_fid(EF_MINPINLEN, NULL, SPECIFY_EF);
-        if (file_has_data(ef_minpin) && file_get_data(ef_minpin)[1] == 1) {
+        if (fido_conf.force_pin_change) {
             CBOR_ERROR(CTAP2_ERR_PIN_INVALID);
         }
         resetPinUvAuthToken();
@@ -611,7 +594,7 @@ int cbor_client_pin(const uint8_t *data, size_t len) {
         }
         paut.permissions = (uint8_t)permissions;
         if (rpId.present == true) {
-            mbedtls_sha256((uint8_t *) rpId.data, rpId.len, paut.rp_id_hash, 0);
+            memcpy(paut.rp_id_hash, rp_info_get(rpId.data, rpId.len)->rp_id_hash, 32);
             paut.has_rp_id = true;
         }
         else {
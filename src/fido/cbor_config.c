@@ -26,7 +26,7 @@
 #include "random.h"
 #include "mbedtls/ecdh.h"
 #include "mbedtls/chachapoly.h"
-#include "mbedtls/sha256.h"
+#include "hash.h"
 #include "file.h"
 
 extern uint8_t keydev_dec[32];
@@ -190,11 +190,7 @@ int cbor_config(const uint8_t *data, size_t len) {
         goto err;
     }
     else if (subcommand == 0x03) {
-        uint8_t currentMinPinLen = 4;
-        file_t *ef_minpin = search_by_fid(EF_MINPINLEN, NULL, SPECIFY_EF);
-        if (file_has_data(ef_minpin)) {
-            currentMinPinLen = *file_get_data(ef_minpin);
-        }
+        uint8_t currentMinPinLen = fido_conf.min_pin_len;
         if (newMinPinLength == 0) {
             newMinPinLength = currentMinPinLen;
         }
@@ -207,15 +203,23 @@ int cbor_config(const uint8_t *data, size_t len) {
         if (file_has_data(ef_pin) && file_get_data(ef_pin)[1] < newMinPinLength) {
             forceChangePin = ptrue;
         }
-        uint8_t *dataf = (uint8_t *) calloc(1, 2 + minPinLengthRPIDs_len * 32);
-        dataf[0] = (uint8_t)newMinPinLength;
-        dataf[1] = forceChangePin == ptrue ? 1 : 0;
-        for (size_t m = 0; m < minPinLengthRPIDs_len; m++) {
-            mbedtls_sha256((uint8_t *) minPinLengthRPIDs[m].data, minPinLengthRPIDs[m].len, dataf + 2 + m * 32, 0);
+        uint8_t *rp_hashes = NULL;
+        if (minPinLengthRPIDs_len > 0) {
+            rp_hashes = (uint8_t *) calloc(minPinLengthRPIDs_len, 32);
+            if (!rp_hashes) {
+                CBOR_ERROR(CTAP2_ERR_PROCESSING);
+            }
+            for (size_t m = 0; m < minPinLengthRPIDs_len; m++) {
+                hash_sha256((uint8_t *) minPinLengthRPIDs[m].data, minPinLengthRPIDs[m].len, rp_hashes + m * 32);
+            }
+        }
+        int ret = fido_conf_set_min_pin((uint8_t)newMinPinLength, forceChangePin == ptrue, rp_hashes, (uint8_t)minPinLengthRPIDs_len);
+        if (rp_hashes) {
+            free(rp_hashes);
+        }
+        if (ret != PICOKEY_OK) {
+            CBOR_ERROR(CTAP2_ERR_PROCESSING);
         }
-        file_put_data(ef_minpin, dataf, (uint16_t)(2 + minPinLengthRPIDs_len * 32));
-        low_flash_available();
-        free(dataf);
         goto err; //No return
     }
     else if (subcommand == 0x01) {
@@ -76,7 +76,7 @@ int cbor_cred_mgmt(const uint8_t *data, size_t len) {
                         CBOR_FIELD_GET_KEY_TEXT(3);
                         CBOR_FIELD_KEY_TEXT_VAL_BYTES(3, "id", credentialId.id);
                         CBOR_FIELD_KEY_TEXT_VAL_TEXT(3, "type", credentialId.type);
-                        if (strcmp(_fd3, "transports") == 0) {
+                        if (CBOR_FIELD_KEY_TEXT_IS(3, "transports")) {
                             CBOR_PARSE_ARRAY_START(_f3, 4)
                             {
                                 CBOR_FIELD_GET_TEXT(credentialId.transports[credentialId.
@@ -129,12 +129,7 @@ int cbor_cred_mgmt(const uint8_t *data, size_t len) {
             (!(paut.permissions & CTAP_PERMISSION_CM) || paut.has_rp_id == true)) {
             CBOR_ERROR(CTAP2_ERR_PIN_AUTH_INVALID);
         }
-        uint8_t existing = 0;
-        for (int i = 0; i < MAX_RESIDENT_CREDENTIALS; i++) {
-            if (file_has_data(search_dynamic_file((uint16_t)(EF_CRED + i)))) {
-                existing++;
-            }
-        }
+        uint16_t existing = slot_map_count(cred_used, MAX_RESIDENT_CREDENTIALS);
         CBOR_CHECK(cbor_encoder_create_map(&encoder, &mapEncoder, 2));
         CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x01));
         CBOR_CHECK(cbor_encode_uint(&mapEncoder, existing));
@@ -160,7 +155,7 @@ int cbor_cred_mgmt(const uint8_t *data, size_t len) {
         }
         uint8_t skip = 0;
         for (int i = 0; i < MAX_RESIDENT_CREDENTIALS; i++) {
-            file_t *tef = search_dynamic_file((uint16_t)(EF_RP + i));
+            file_t *tef = rp_slots[i];
             if (file_has_data(tef) && *file_get_data(tef) > 0) {
                 if (++skip == rp_counter) {
                     if (rp_ef == NULL) {
@@ -219,7 +214,7 @@ int cbor_cred_mgmt(const uint8_t *data, size_t len) {
         file_t *cred_ef = NULL;
         uint8_t skip = 0;
         for (int i = 0; i < MAX_RESIDENT_CREDENTIALS; i++) {
-            file_t *tef = search_dynamic_file((uint16_t)(EF_CRED + i));
+            file_t *tef = cred_slots[i];
             if (file_has_data(tef) && memcmp(file_get_data(tef), rpIdHash.data, 32) == 0) {
                 if (++skip == cred_counter) {
                     if (cred_ef == NULL) {
@@ -350,34 +345,30 @@ int cbor_cred_mgmt(const uint8_t *data, size_t len) {
              (paut.has_rp_id == true && memcmp(paut.rp_id_hash, rpIdHash.data, 32) != 0))) {
             CBOR_ERROR(CTAP2_ERR_PIN_AUTH_INVALID);
         }
-        for (int i = 0; i < MAX_RESIDENT_CREDENTIALS; i++) {
-            file_t *ef = search_dynamic_file((uint16_t)(EF_CRED + i));
-            if (file_has_data(ef) && memcmp(file_get_data(ef) + 32, credentialId.id.data, MIN(file_get_size(ef) - 32, credentialId.id.len)) == 0) {
-                uint8_t *rp_id_hash = file_get_data(ef);
-                if (delete_file(ef) != 0) {
-                    CBOR_ERROR(CTAP2_ERR_NOT_ALLOWED);
-                }
-                for (int j = 0; j < MAX_RESIDENT_CREDENTIALS; j++) {
-                    file_t *rp_ef = search_dynamic_file((uint16_t)(EF_RP + j));
-                    if (file_has_data(rp_ef) && memcmp(file_get_data(rp_ef) + 1, rp_id_hash, 32) == 0) {
-                        uint8_t *rp_data = (uint8_t *) calloc(1, file_get_size(rp_ef));
-                        memcpy(rp_data, file_get_data(rp_ef), file_get_size(rp_ef));
-                        rp_data[0] -= 1;
-                        if (rp_data[0] == 0) {
-                            delete_file(rp_ef);
-                        }
-                        else {
-                            file_put_data(rp_ef, rp_data, file_get_size(rp_ef));
-                        }
-                        free(rp_data);
-                        break;
-                    }
-                }
-                low_flash_available();
-                goto err; //no error
+        int slot = credential_index_find(credentialId.id.data, credentialId.id.len);
+        if (slot < 0) {
+            CBOR_ERROR(CTAP2_ERR_NO_CREDENTIALS);
+        }
+        int rp_slot = credential_index_rp_slot((uint16_t)slot);
+        if (slot_delete_file(cred_slots[slot]) != 0) {
+            CBOR_ERROR(CTAP2_ERR_NOT_ALLOWED);
+        }
+        rp_info_set_resident(NULL, RP_RESIDENT_UNKNOWN);
+        file_t *rp_ef = rp_slot >= 0 ? rp_slots[rp_slot] : NULL;
+        if (file_has_data(rp_ef)) {
+            uint8_t *rp_data = (uint8_t *) calloc(1, file_get_size(rp_ef));
+            memcpy(rp_data, file_get_data(rp_ef), file_get_size(rp_ef));
+            rp_data[0] -= 1;
+            if (rp_data[0] == 0) {
+                slot_delete_file(rp_ef);
+            }
+            else {
+                file_put_data(rp_ef, rp_data, file_get_size(rp_ef));
             }
+            free(rp_data);
         }
-        CBOR_ERROR(CTAP2_ERR_NO_CREDENTIALS);
+        low_flash_available();
+        goto err; //no error
     }
     else if (subcommand == 0x07) {
         if (credentialId.id.present == false || user.id.present == false) {
@@ -392,36 +383,36 @@ int cbor_cred_mgmt(const uint8_t *data, size_t len) {
              (paut.has_rp_id == true && memcmp(paut.rp_id_hash, rpIdHash.data, 32) != 0))) {
             CBOR_ERROR(CTAP2_ERR_PIN_AUTH_INVALID);
         }
-        for (int i = 0; i < MAX_RESIDENT_CREDENTIALS; i++) {
-            file_t *ef = search_dynamic_file((uint16_t)(EF_CRED + i));
-            if (file_has_data(ef) && memcmp(file_get_data(ef) + 32, credentialId.id.data, MIN(file_get_size(ef) - 32, credentialId.id.len)) == 0) {
-                Credential cred = { 0 };
-                uint8_t *rp_id_hash = file_get_data(ef);
-                if (credential_load(rp_id_hash + 32, file_get_size(ef) - 32, rp_id_hash, &cred) != 0) {
-                    CBOR_ERROR(CTAP2_ERR_NOT_ALLOWED);
-                }
-                if (memcmp(user.id.data, cred.userId.data, MIN(user.id.len, cred.userId.len)) != 0) {
-                    credential_free(&cred);
-                    CBOR_ERROR(CTAP1_ERR_INVALID_PARAMETER);
-                }
-                uint8_t newcred[MAX_CRED_ID_LENGTH];
-                size_t newcred_len = 0;
-                if (credential_create(&cred.rpId, &cred.userId, &user.parent.name,
-                                      &user.displayName, &cred.opts, &cred.extensions,
-                                      cred.use_sign_count, (int)cred.alg,
-                                      (int)cred.curve, newcred, &newcred_len) != 0) {
-                    credential_free(&cred);
-                    CBOR_ERROR(CTAP2_ERR_NOT_ALLOWED);
-                }
-                credential_free(&cred);
-                if (credential_store(newcred, newcred_len, rp_id_hash) != 0) {
-                    CBOR_ERROR(CTAP2_ERR_NOT_ALLOWED);
-                }
-                low_flash_available();
-                goto err; //no error
-            }
+        int slot = credential_index_find(credentialId.id.data, credentialId.id.len);
+        if (slot < 0) {
+            CBOR_ERROR(CTAP2_ERR_NO_CREDENTIALS);
+        }
+        file_t *ef = cred_slots[slot];
+        Credential cred = { 0 };
+        uint8_t rp_id_hash[32];
+        memcpy(rp_id_hash, file_get_data(ef), sizeof(rp_id_hash));
+        if (credential_load(file_get_data(ef) + 32, file_get_size(ef) - 32, rp_id_hash, &cred) != 0) {
+            CBOR_ERROR(CTAP2_ERR_NOT_ALLOWED);
+        }
+        if (memcmp(user.id.data, cred.userId.data, MIN(user.id.len, cred.userId.len)) != 0) {
+            credential_free(&cred);
+            CBOR_ERROR(CTAP1_ERR_INVALID_PARAMETER);
+        }
+        uint8_t newcred[MAX_CRED_ID_LENGTH];
+        size_t newcred_len = 0;
+        if (credential_create(&cred.rpId, &cred.userId, &user.parent.name,
+                              &user.displayName, &cred.opts, &cred.extensions,
+                              cred.use_sign_count, (int)cred.alg,
+                              (int)cred.curve, newcred, &newcred_len) != 0) {
+            credential_free(&cred);
+            CBOR_ERROR(CTAP2_ERR_NOT_ALLOWED);
+        }
+        credential_free(&cred);
+        if (credential_store(newcred, newcred_len, rp_id_hash) != 0) {
+            CBOR_ERROR(CTAP2_ERR_NOT_ALLOWED);
         }
-        CBOR_ERROR(CTAP2_ERR_NO_CREDENTIALS);
+        low_flash_available();
+        goto err; //no error
     }
     CBOR_CHECK(cbor_encoder_close_container(&encoder, &mapEncoder));
     resp_size = cbor_encoder_get_buffer_size(&encoder, ctap_resp->init.data + 1);
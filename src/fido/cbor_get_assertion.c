@@ -28,7 +28,7 @@
 #include "apdu.h"
 #include "cbor_make_credential.h"
 #include "credential.h"
-#include "mbedtls/sha256.h"
+#include "hash.h"
 #include "random.h"
 
 int cbor_get_assertion(const uint8_t *data, size_t len, bool next);
@@ -89,14 +89,19 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
     CborError error = CborNoError;
     CborByteString pinUvAuthParam = { 0 }, clientDataHash = { 0 };
     CborCharString rpId = { 0 };
-    PublicKeyCredentialDescriptor allowList[MAX_CREDENTIAL_COUNT_IN_LIST] = { 0 };
+    PublicKeyCredentialDescriptor allowCred = { 0 };
     Credential creds[MAX_CREDENTIAL_COUNT_IN_LIST] = { 0 };
     size_t allowList_len = 0, creds_len = 0;
-    uint8_t *aut_data = NULL;
+    bool allowList_invalid = false, allowList_present = false;
+    CborValue allowList = { 0 };
     bool asserted = false, up = true, uv = false;
     int64_t kty = 2, alg = 0, crv = 0;
     CborByteString kax = { 0 }, kay = { 0 }, salt_enc = { 0 }, salt_auth = { 0 };
     const bool *credBlob = NULL;
+    mbedtls_ecdsa_context ekey;
+    mbedtls_ecdsa_init(&ekey);
+    auth_data_t ad = { 0 };
+    uint8_t cred_key[32] = { 0 };
 
     CBOR_CHECK(cbor_parser_init(data, len, 0, &parser, &map));
     uint64_t val_c = 1;
@@ -117,35 +122,18 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
         else if (val_u == 0x02) {
             CBOR_FIELD_GET_BYTES(clientDataHash, 1);
         }
-        else if (val_u == 0x03) { // excludeList
-            CBOR_PARSE_ARRAY_START(_f1, 2)
-            {
-                PublicKeyCredentialDescriptor *pc = &allowList[allowList_len];
-                CBOR_PARSE_MAP_START(_f2, 3)
-                {
-                    CBOR_FIELD_GET_KEY_TEXT(3);
-                    CBOR_FIELD_KEY_TEXT_VAL_BYTES(3, "id", pc->id);
-                    CBOR_FIELD_KEY_TEXT_VAL_TEXT(3, "type", pc->type);
-                    if (strcmp(_fd3, "transports") == 0) {
-                        CBOR_PARSE_ARRAY_START(_f3, 4)
-                        {
-                            CBOR_FIELD_GET_TEXT(pc->transports[pc->transports_len], 4);
-                            pc->transports_len++;
-                        }
-                        CBOR_PARSE_ARRAY_END(_f3, 4);
-                    }
-                }
-                CBOR_PARSE_MAP_END(_f2, 3);
-                allowList_len++;
-            }
-            CBOR_PARSE_ARRAY_END(_f1, 2);
+        else if (val_u == 0x03) { // allowList
+            CBOR_ASSERT(cbor_value_is_array(&_f1) == true);
+            allowList = _f1;
+            allowList_present = true;
+            CBOR_ADVANCE(1);
         }
         else if (val_u == 0x04) { // extensions
             extensions.present = true;
             CBOR_PARSE_MAP_START(_f1, 2)
             {
                 CBOR_FIELD_GET_KEY_TEXT(2);
-                if (strcmp(_fd2, "hmac-secret") == 0) {
+                if (CBOR_FIELD_KEY_TEXT_IS(2, "hmac-secret")) {
                     extensions.hmac_secret = ptrue;
                     uint64_t ukey = 0;
                     CBOR_PARSE_MAP_START(_f2, 3)
@@ -203,8 +191,51 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
     }
 
     uint8_t flags = 0;
-    uint8_t rp_id_hash[32] = {0};
-    mbedtls_sha256((uint8_t *) rpId.data, rpId.len, rp_id_hash, 0);
+    const rp_info_t *rpi = rp_info_get(rpId.data, rpId.len);
+    uint8_t rp_id_hash[32] = {0}, rp_resident = rpi->resident;
+    memcpy(rp_id_hash, rpi->rp_id_hash, 32);
+    // Derived once for all the credentials loaded by this request
+    if (next == false && (allowList_present == true || rp_resident != RP_RESIDENT_NONE)) {
+        credential_derive_chacha_key(cred_key);
+    }
+
+    if (allowList_present == true) {
+        /*
+         * The list is walked once the map is closed, so rpId is always known
+         * whatever the order of the keys. Entries are verified one by one and
+         * only the credentials that load for this RP are kept, so the length
+         * of the list is not bounded by creds[].
+         */
+        CBOR_PARSE_ARRAY_START(allowList, 2)
+        {
+            CBOR_PARSE_MAP_START(_f2, 3)
+            {
+                CBOR_FIELD_GET_KEY_TEXT(3);
+                CBOR_FIELD_KEY_TEXT_VAL_BYTES(3, "id", allowCred.id);
+                CBOR_FIELD_KEY_TEXT_VAL_TEXT(3, "type", allowCred.type);
+                CBOR_ADVANCE(3);
+            }
+            CBOR_PARSE_MAP_END(_f2, 3);
+            allowList_len++;
+            if (allowCred.type.present == false || allowCred.id.present == false) {
+                allowList_invalid = true;
+            }
+            else if (next == false && creds_len < MAX_CREDENTIAL_COUNT_IN_LIST && strcmp(allowCred.type.data, "public-key") == 0) {
+                if (fido_yield() == true) {
+                    CBOR_ERROR(CTAP2_ERR_KEEPALIVE_CANCEL);
+                }
+                if (credential_load_key(allowCred.id.data, allowCred.id.len, rp_id_hash, cred_key, &creds[creds_len]) != 0) {
+                    credential_free(&creds[creds_len]);
+                }
+                else {
+                    creds_len++;
+                }
+            }
+            CBOR_FREE_BYTE_STRING(allowCred.type);
+            CBOR_FREE_BYTE_STRING(allowCred.id);
+        }
+        CBOR_PARSE_ARRAY_END(allowList, 2);
+    }
 
     bool resident = false;
     uint8_t numberOfCredentials = 0;
@@ -280,36 +311,33 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
         }
 
         if (allowList_len > 0) {
-            for (size_t e = 0; e < allowList_len; e++) {
-                if (allowList[e].type.present == false || allowList[e].id.present == false) {
-                    CBOR_ERROR(CTAP2_ERR_MISSING_PARAMETER);
-                }
-                if (strcmp(allowList[e].type.data, "public-key") != 0) {
-                    continue;
-                }
-                if (credential_load(allowList[e].id.data, allowList[e].id.len, rp_id_hash, &creds[creds_len]) != 0) {
-                    CBOR_FREE_BYTE_STRING(allowList[e].id);
-                    credential_free(&creds[creds_len]);
-                }
-                else {
-                    creds_len++;
-                }
+            if (allowList_invalid == true) {
+                CBOR_ERROR(CTAP2_ERR_MISSING_PARAMETER);
             }
         }
         else {
-            for (int i = 0; i < MAX_RESIDENT_CREDENTIALS && creds_len < MAX_CREDENTIAL_COUNT_IN_LIST; i++) {
-                file_t *ef = search_dynamic_file((uint16_t)(EF_CRED + i));
+            bool found = false;
+            for (int i = 0; i < MAX_RESIDENT_CREDENTIALS && creds_len < MAX_CREDENTIAL_COUNT_IN_LIST && rp_resident != RP_RESIDENT_NONE; i++) {
+                file_t *ef = cred_slots[i];
                 if (!file_has_data(ef) || memcmp(file_get_data(ef), rp_id_hash, 32) != 0) {
                     continue;
                 }
-                int ret = credential_load(file_get_data(ef) + 32, file_get_size(ef) - 32, rp_id_hash,  &creds[creds_len]);
+                found = true;
+                if (fido_yield() == true) {
+                    CBOR_ERROR(CTAP2_ERR_KEEPALIVE_CANCEL);
+                }
+                int ret = credential_load_key(file_get_data(ef) + 32, file_get_size(ef) - 32, rp_id_hash, cred_key, &creds[creds_len]);
                 if (ret != 0) {
                     credential_free(&creds[creds_len]);
                 }
                 else {
+                    credential_index_put((uint16_t)i, &creds[creds_len]);
                     creds_len++;
                 }
             }
+            if (rp_resident == RP_RESIDENT_UNKNOWN) {
+                rp_info_set_resident(rp_id_hash, found ? RP_RESIDENT_SOME : RP_RESIDENT_NONE);
+            }
             resident = true;
         }
         for (size_t i = 0; i < creds_len; i++) {
@@ -325,6 +353,7 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
                     else {
                         if (numberOfCredentials != i) {
                             creds[numberOfCredentials++] = creds[i];
+                            memset(&creds[i], 0, sizeof(Credential));
                         }
                         else {
                             numberOfCredentials++;
@@ -334,6 +363,7 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
                 else {
                     if (numberOfCredentials != i) {
                         creds[numberOfCredentials++] = creds[i];
+                        memset(&creds[i], 0, sizeof(Credential));
                     }
                     else {
                         numberOfCredentials++;
@@ -345,15 +375,7 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
             CBOR_ERROR(CTAP2_ERR_NO_CREDENTIALS);
         }
 
-        for (int i = 0; i < numberOfCredentials; i++) {
-            for (int j = i + 1; j < numberOfCredentials; j++) {
-                if (creds[j].creation > creds[i].creation) {
-                    Credential tmp = creds[j];
-                    creds[j] = creds[i];
-                    creds[i] = tmp;
-                }
-            }
-        }
+        credential_sort_recent_first(creds, numberOfCredentials);
 
         if (options.up == ptrue || options.present == false || options.up == NULL) { //9.1
             if (pinUvAuthParam.present == true) {
@@ -417,10 +439,56 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
         }
     }
 
-    size_t ext_len = 0;
-    uint8_t ext[512] = {0};
+    uint8_t lfields = 3;
+    if (selcred->opts.present == true && selcred->opts.rk == ptrue) {
+        lfields++;
+    }
+    if (numberOfCredentials > 1 && next == false) {
+        lfields++;
+    }
+    if (extensions.largeBlobKey == ptrue && selcred->extensions.largeBlobKey == ptrue) {
+        lfields++;
+    }
+    cbor_encoder_init(&encoder, ctap_resp->init.data + 1, CTAP_MAX_CBOR_PAYLOAD, 0);
+    CBOR_CHECK(cbor_encoder_create_map(&encoder, &mapEncoder, lfields));
+
+    CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x01));
+    CBOR_CHECK(cbor_encoder_create_map(&mapEncoder, &mapEncoder2, 2));
+    CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "id"));
+    CBOR_CHECK(cbor_encode_byte_string(&mapEncoder2, selcred->id.data, selcred->id.len));
+    CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "type"));
+    CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "public-key"));
+    CBOR_CHECK(cbor_encoder_close_container(&mapEncoder, &mapEncoder2));
+
+    CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x02));
+
+    uint8_t hash[64] = {0}, sig[MBEDTLS_ECDSA_MAX_LEN] = {0};
+    const mbedtls_md_info_t *md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    ret = fido_load_key((int)selcred->curve, selcred->id.data, &ekey);
+    if (ret == CTAP2_ERR_KEEPALIVE_CANCEL) {
+        CBOR_ERROR(CTAP2_ERR_KEEPALIVE_CANCEL);
+    }
+    if (ret != 0) {
+        if (derive_key(rp_id_hash, false, selcred->id.data, MBEDTLS_ECP_DP_SECP256R1, &ekey) != 0) {
+            CBOR_ERROR(CTAP1_ERR_OTHER);
+        }
+    }
+    if (ekey.grp.id == MBEDTLS_ECP_DP_SECP384R1) {
+        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA384);
+    }
+    else if (ekey.grp.id == MBEDTLS_ECP_DP_SECP521R1) {
+        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA512);
+    }
     if (extensions.present == true) {
-        cbor_encoder_init(&encoder, ext, sizeof(ext), 0);
+        flags |= FIDO2_AUT_FLAG_ED;
+    }
+    uint32_t ctr = get_sign_counter();
+    if (auth_data_begin(&ad, &mapEncoder, ctap_resp->init.data + 1, CTAP_MAX_CBOR_PAYLOAD, md, rp_id_hash, flags, ctr) != 0) {
+        CBOR_ERROR(CTAP1_ERR_OTHER);
+    }
+    CborEncoder autEncoder, autMapEncoder;
+    if (extensions.present == true) {
+        auth_data_encoder(&ad, &autEncoder);
         int l = 0;
         if (options.up == pfalse) {
             extensions.hmac_secret = NULL;
@@ -434,20 +502,20 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
         if (extensions.thirdPartyPayment != NULL) {
             l++;
         }
-        CBOR_CHECK(cbor_encoder_create_map(&encoder, &mapEncoder, l));
+        CBOR_CHECK(cbor_encoder_create_map(&autEncoder, &autMapEncoder, l));
         if (credBlob == ptrue) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder, "credBlob"));
+            CBOR_CHECK(cbor_encode_text_stringz(&autMapEncoder, "credBlob"));
             if (selcred->extensions.credBlob.present == true) {
-                CBOR_CHECK(cbor_encode_byte_string(&mapEncoder, selcred->extensions.credBlob.data,
+                CBOR_CHECK(cbor_encode_byte_string(&autMapEncoder, selcred->extensions.credBlob.data,
                                                    selcred->extensions.credBlob.len));
             }
             else {
-                CBOR_CHECK(cbor_encode_byte_string(&mapEncoder, NULL, 0));
+                CBOR_CHECK(cbor_encode_byte_string(&autMapEncoder, NULL, 0));
             }
         }
         if (extensions.hmac_secret != NULL) {
 
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder, "hmac-secret"));
+            CBOR_CHECK(cbor_encode_text_stringz(&autMapEncoder, "hmac-secret"));
 
             uint8_t sharedSecret[64] = {0};
             mbedtls_ecp_point Qp;
@@ -490,90 +558,39 @@ int cbor_get_assertion(const uint8_t *data, size_t len, bool next) {
                 crd = cred_random;
             }
             uint8_t out1[64] = {0}, hmac_res[80] = {0};
-            mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), crd, 32, salt_dec, 32, out1);
+            hash_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), crd, 32, salt_dec, 32, out1);
             if ((uint8_t)salt_enc.len == 64 + poff) {
-                mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), crd, 32, salt_dec + 32, 32, out1 + 32);
+                hash_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), crd, 32, salt_dec + 32, 32, out1 + 32);
             }
             encrypt((uint8_t)hmacSecretPinUvAuthProtocol, sharedSecret, out1, (uint16_t)(salt_enc.len - poff), hmac_res);
-            CBOR_CHECK(cbor_encode_byte_string(&mapEncoder, hmac_res, salt_enc.len));
+            CBOR_CHECK(cbor_encode_byte_string(&autMapEncoder, hmac_res, salt_enc.len));
         }
         if (extensions.thirdPartyPayment != NULL) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder, "thirdPartyPayment"));
+            CBOR_CHECK(cbor_encode_text_stringz(&autMapEncoder, "thirdPartyPayment"));
             if (selcred->extensions.thirdPartyPayment == ptrue) {
-                CBOR_CHECK(cbor_encode_boolean(&mapEncoder, true));
+                CBOR_CHECK(cbor_encode_boolean(&autMapEncoder, true));
             }
             else {
-                CBOR_CHECK(cbor_encode_boolean(&mapEncoder, false));
+                CBOR_CHECK(cbor_encode_boolean(&autMapEncoder, false));
             }
         }
 
-        CBOR_CHECK(cbor_encoder_close_container(&encoder, &mapEncoder));
-        ext_len = cbor_encoder_get_buffer_size(&encoder, ext);
-        flags |= FIDO2_AUT_FLAG_ED;
-    }
-
-    uint32_t ctr = get_sign_counter();
-
-    size_t aut_data_len = 32 + 1 + 4 + ext_len;
-    aut_data = (uint8_t *) calloc(1, aut_data_len + clientDataHash.len);
-    uint8_t *pa = aut_data;
-    memcpy(pa, rp_id_hash, 32); pa += 32;
-    *pa++ = flags;
-    *pa++ = (ctr >> 24) & 0xFF;
-    *pa++ = (ctr >> 16) & 0xFF;
-    *pa++ = (ctr >> 8) & 0xFF;
-    *pa++ = ctr & 0xFF;
-    memcpy(pa, ext, ext_len); pa += ext_len;
-    if ((size_t)(pa - aut_data) != aut_data_len) {
-        CBOR_ERROR(CTAP1_ERR_OTHER);
-    }
-
-    memcpy(pa, clientDataHash.data, clientDataHash.len);
-    uint8_t hash[64] = {0}, sig[MBEDTLS_ECDSA_MAX_LEN] = {0};
-    const mbedtls_md_info_t *md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
-    mbedtls_ecdsa_context ekey;
-    mbedtls_ecdsa_init(&ekey);
-    ret = fido_load_key((int)selcred->curve, selcred->id.data, &ekey);
-    if (ret != 0) {
-        if (derive_key(rp_id_hash, false, selcred->id.data, MBEDTLS_ECP_DP_SECP256R1, &ekey) != 0) {
-            mbedtls_ecdsa_free(&ekey);
+        CBOR_CHECK(cbor_encoder_close_container(&autEncoder, &autMapEncoder));
+        if (auth_data_encoded(&ad, &autEncoder) != 0) {
             CBOR_ERROR(CTAP1_ERR_OTHER);
         }
     }
-    if (ekey.grp.id == MBEDTLS_ECP_DP_SECP384R1) {
-        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA384);
-    }
-    else if (ekey.grp.id == MBEDTLS_ECP_DP_SECP521R1) {
-        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA512);
+
+    if (auth_data_end(&ad, &mapEncoder, clientDataHash.data, clientDataHash.len, hash) != 0) {
+        CBOR_ERROR(CTAP1_ERR_OTHER);
     }
-    ret = mbedtls_md(md, aut_data, aut_data_len + clientDataHash.len, hash);
     size_t olen = 0;
     ret = mbedtls_ecdsa_write_signature(&ekey, mbedtls_md_get_type(md), hash, mbedtls_md_get_size(md), sig, sizeof(sig), &olen, random_gen, NULL);
     mbedtls_ecdsa_free(&ekey);
-
-    uint8_t lfields = 3;
-    if (selcred->opts.present == true && selcred->opts.rk == ptrue) {
-        lfields++;
-    }
-    if (numberOfCredentials > 1 && next == false) {
-        lfields++;
-    }
-    if (extensions.largeBlobKey == ptrue && selcred->extensions.largeBlobKey == ptrue) {
-        lfields++;
+    if (ret != 0) {
+        CBOR_ERROR(CTAP1_ERR_OTHER);
     }
-    cbor_encoder_init(&encoder, ctap_resp->init.data + 1, CTAP_MAX_CBOR_PAYLOAD, 0);
-    CBOR_CHECK(cbor_encoder_create_map(&encoder, &mapEncoder, lfields));
 
-    CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x01));
-    CBOR_CHECK(cbor_encoder_create_map(&mapEncoder, &mapEncoder2, 2));
-    CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "id"));
-    CBOR_CHECK(cbor_encode_byte_string(&mapEncoder2, selcred->id.data, selcred->id.len));
-    CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "type"));
-    CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "public-key"));
-    CBOR_CHECK(cbor_encoder_close_container(&mapEncoder, &mapEncoder2));
-
-    CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x02));
-    CBOR_CHECK(cbor_encode_byte_string(&mapEncoder, aut_data, aut_data_len));
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x03));
     CBOR_CHECK(cbor_encode_byte_string(&mapEncoder, sig, olen));
 
@@ -632,16 +649,11 @@ err:
         }
     }
 
-    for (size_t m = 0; m < MAX_CREDENTIAL_COUNT_IN_LIST; m++) {
-        CBOR_FREE_BYTE_STRING(allowList[m].type);
-        CBOR_FREE_BYTE_STRING(allowList[m].id);
-        for (size_t n = 0; n < 8; n++) {
-            CBOR_FREE_BYTE_STRING(allowList[m].transports[n]);
-        }
-    }
-    if (aut_data) {
-        free(aut_data);
-    }
+    CBOR_FREE_BYTE_STRING(allowCred.type);
+    CBOR_FREE_BYTE_STRING(allowCred.id);
+    mbedtls_platform_zeroize(cred_key, sizeof(cred_key));
+    mbedtls_ecdsa_free(&ekey);
+    auth_data_free(&ad);
     if (error != CborNoError) {
         if (error == CborErrorImproperValue) {
             return CTAP2_ERR_CBOR_UNEXPECTED_TYPE;
@@ -23,10 +23,25 @@
 #include "apdu.h"
 #include "version.h"
 
-int cbor_get_info() {
+/*
+ * The getInfo response only depends on whether a PIN is set and on fido_conf
+ * (minPINLength, forcePINChange and EF_OPTS). It is encoded once into
+ * get_info_cache and served from there until one of them changes and
+ * cbor_get_info_invalidate() is called, so the common case is a memcpy.
+ */
+#define GET_INFO_CACHE_SIZE 512
+
+static uint8_t get_info_cache[GET_INFO_CACHE_SIZE];
+static uint16_t get_info_cache_len = 0;
+
+void cbor_get_info_invalidate() {
+    get_info_cache_len = 0;
+}
+
+static int cbor_get_info_encode(uint8_t *buf, size_t buf_len, uint16_t *len) {
     CborEncoder encoder, mapEncoder, arrayEncoder, mapEncoder2;
     CborError error = CborNoError;
-    cbor_encoder_init(&encoder, ctap_resp->init.data + 1, CTAP_MAX_CBOR_PAYLOAD, 0);
+    cbor_encoder_init(&encoder, buf, buf_len, 0);
     CBOR_CHECK(cbor_encoder_create_map(&encoder, &mapEncoder, 15));
 
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x01));
@@ -100,22 +115,10 @@ int cbor_get_info() {
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x0B));
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, MAX_LARGE_BLOB_SIZE)); // maxSerializedLargeBlobArray
 
-    file_t *ef_minpin = search_by_fid(EF_MINPINLEN, NULL, SPECIFY_EF);
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x0C));
-    if (file_has_data(ef_minpin) && file_get_data(ef_minpin)[1] == 1) {
-        CBOR_CHECK(cbor_encode_boolean(&mapEncoder, true));
-    }
-    else {
-        CBOR_CHECK(cbor_encode_boolean(&mapEncoder, false));
-    }
+    CBOR_CHECK(cbor_encode_boolean(&mapEncoder, fido_conf.force_pin_change));
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x0D));
-    if (file_has_data(ef_minpin)) {
-        CBOR_CHECK(cbor_encode_uint(&mapEncoder, *file_get_data(ef_minpin))); // minPINLength
-    }
-    else {
-        CBOR_CHECK(cbor_encode_uint(&mapEncoder, 4)); // minPINLength
-
-    }
+    CBOR_CHECK(cbor_encode_uint(&mapEncoder, fido_conf.min_pin_len)); // minPINLength
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x0E));
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, PICO_FIDO_VERSION)); // firmwareVersion
 
@@ -133,6 +136,19 @@ err:
     if (error != CborNoError) {
         return -CTAP2_ERR_INVALID_CBOR;
     }
-    res_APDU_size = (uint16_t)cbor_encoder_get_buffer_size(&encoder, ctap_resp->init.data + 1);
+    *len = (uint16_t)cbor_encoder_get_buffer_size(&encoder, buf);
+    return 0;
+}
+
+int cbor_get_info() {
+    if (get_info_cache_len == 0) {
+        int ret = cbor_get_info_encode(get_info_cache, sizeof(get_info_cache), &get_info_cache_len);
+        if (ret != 0) {
+            get_info_cache_len = 0;
+            return ret;
+        }
+    }
+    memcpy(ctap_resp->init.data + 1, get_info_cache, get_info_cache_len);
+    res_APDU_size = get_info_cache_len;
     return 0;
 }
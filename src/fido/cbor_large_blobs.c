@@ -22,7 +22,7 @@
 #include "files.h"
 #include "apdu.h"
 #include "pico_keys.h"
-#include "mbedtls/sha256.h"
+#include "hash.h"
 
 static uint64_t expectedLength = 0, expectedNextOffset = 0;
 uint8_t temp_lba[MAX_LARGE_BLOB_SIZE];
@@ -133,7 +133,7 @@ int cbor_large_blobs(const uint8_t *data, size_t len) {
         verify_data[35] = (offset >> 8) & 0xFF;
         verify_data[36] = (offset >> 16) & 0xFF;
         verify_data[37] = (offset >> 24) & 0xFF;
-        mbedtls_sha256(set.data, set.len, verify_data + 38, 0);
+        hash_sha256(set.data, set.len, verify_data + 38);
         if (verify((uint8_t)pinUvAuthProtocol, paut.data, verify_data, (uint16_t)sizeof(verify_data), pinUvAuthParam.data) != 0) {
             CBOR_ERROR(CTAP2_ERR_PIN_AUTH_INVALID);
         }
@@ -150,7 +150,7 @@ int cbor_large_blobs(const uint8_t *data, size_t len) {
         expectedNextOffset += set.len;
         if (expectedNextOffset == expectedLength) {
             uint8_t sha[32];
-            mbedtls_sha256(temp_lba, expectedLength - 16, sha, 0);
+            hash_sha256(temp_lba, expectedLength - 16, sha);
             if (expectedLength > 17 && memcmp(sha, temp_lba + expectedLength - 16, 16) != 0) {
                 CBOR_ERROR(CTAP2_ERR_INTEGRITY_FAILURE);
             }
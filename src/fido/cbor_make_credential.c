@@ -36,13 +36,17 @@ int cbor_make_credential(const uint8_t *data, size_t len) {
     PublicKeyCredentialUserEntity user = { 0 };
     PublicKeyCredentialParameters pubKeyCredParams[MAX_CREDENTIAL_COUNT_IN_LIST] = { 0 };
     size_t pubKeyCredParams_len = 0;
-    PublicKeyCredentialDescriptor excludeList[MAX_CREDENTIAL_COUNT_IN_LIST] = { 0 };
-    size_t excludeList_len = 0;
+    PublicKeyCredentialDescriptor excludeCred = { 0 };
+    bool excluded = false, excluded_uv = false, excludeList_invalid = false, excludeList_present = false;
+    CborValue excludeList = { 0 };
     CredOptions options = { 0 };
     uint64_t pinUvAuthProtocol = 0, enterpriseAttestation = 0;
-    uint8_t *aut_data = NULL;
     size_t resp_size = 0;
     CredExtensions extensions = { 0 };
+    mbedtls_ecdsa_context ekey;
+    mbedtls_ecdsa_init(&ekey);
+    auth_data_t ad = { 0 };
+    uint8_t cred_key[32] = { 0 };
     //options.present = true;
     //options.up = ptrue;
     options.uv = pfalse;
@@ -87,6 +91,10 @@ int cbor_make_credential(const uint8_t *data, size_t len) {
         else if (val_u == 0x04) { // pubKeyCredParams
             CBOR_PARSE_ARRAY_START(_f1, 2)
             {
+                if (pubKeyCredParams_len >= MAX_CREDENTIAL_COUNT_IN_LIST) {
+                    CBOR_ADVANCE(2);
+                    continue;
+                }
                 PublicKeyCredentialParameters *pk = &pubKeyCredParams[pubKeyCredParams_len];
                 CBOR_PARSE_MAP_START(_f2, 3)
                 {
@@ -100,27 +108,10 @@ int cbor_make_credential(const uint8_t *data, size_t len) {
             CBOR_PARSE_ARRAY_END(_f1, 2);
         }
         else if (val_u == 0x05) { // excludeList
-            CBOR_PARSE_ARRAY_START(_f1, 2)
-            {
-                PublicKeyCredentialDescriptor *pc = &excludeList[excludeList_len];
-                CBOR_PARSE_MAP_START(_f2, 3)
-                {
-                    CBOR_FIELD_GET_KEY_TEXT(3);
-                    CBOR_FIELD_KEY_TEXT_VAL_BYTES(3, "id", pc->id);
-                    CBOR_FIELD_KEY_TEXT_VAL_TEXT(3, "type", pc->type);
-                    if (strcmp(_fd3, "transports") == 0) {
-                        CBOR_PARSE_ARRAY_START(_f3, 4)
-                        {
-                            CBOR_FIELD_GET_TEXT(pc->transports[pc->transports_len], 4);
-                            pc->transports_len++;
-                        }
-                        CBOR_PARSE_ARRAY_END(_f3, 4);
-                    }
-                }
-                CBOR_PARSE_MAP_END(_f2, 3);
-                excludeList_len++;
-            }
-            CBOR_PARSE_ARRAY_END(_f1, 2);
+            CBOR_ASSERT(cbor_value_is_array(&_f1) == true);
+            excludeList = _f1;
+            excludeList_present = true;
+            CBOR_ADVANCE(1);
         }
         else if (val_u == 0x06) { // extensions
             extensions.present = true;
@@ -162,8 +153,58 @@ int cbor_make_credential(const uint8_t *data, size_t len) {
     CBOR_PARSE_MAP_END(map, 1);
 
     uint8_t flags = FIDO2_AUT_FLAG_AT;
+    const rp_info_t *rpi = rp_info_get(rp.id.data, rp.id.len);
+    const known_app_t *ka = rpi->ka;
     uint8_t rp_id_hash[32] = {0};
-    mbedtls_sha256((uint8_t *) rp.id.data, rp.id.len, rp_id_hash, 0);
+    memcpy(rp_id_hash, rpi->rp_id_hash, 32);
+
+    if (excludeList_present == true) {
+        /*
+         * The list is walked once the map is closed, so rp is always known
+         * whatever the order of the keys. Entries are verified one by one and
+         * only the outcome is kept, so the length of the list is not bounded.
+         * Parsing continues after the first match but nothing else is
+         * verified. Whether a credProtect=uvRequired match excludes depends
+         * on UV, which is only known later (12.1).
+         */
+        credential_derive_chacha_key(cred_key);
+        CBOR_PARSE_ARRAY_START(excludeList, 2)
+        {
+            CBOR_PARSE_MAP_START(_f2, 3)
+            {
+                CBOR_FIELD_GET_KEY_TEXT(3);
+                CBOR_FIELD_KEY_TEXT_VAL_BYTES(3, "id", excludeCred.id);
+                CBOR_FIELD_KEY_TEXT_VAL_TEXT(3, "type", excludeCred.type);
+                CBOR_ADVANCE(3);
+            }
+            CBOR_PARSE_MAP_END(_f2, 3);
+            if (excludeCred.type.present == false || excludeCred.id.present == false) {
+                excludeList_invalid = true;
+            }
+            else if (excluded == false && strcmp(excludeCred.type.data, "public-key") == 0) {
+                if (fido_yield() == true) {
+                    CBOR_ERROR(CTAP2_ERR_KEEPALIVE_CANCEL);
+                }
+                // Foreign ids are rejected on the tag alone, only a match is decrypted for its credProtect
+                if (credential_verify_tag(excludeCred.id.data, excludeCred.id.len, rp_id_hash, cred_key) == 0) {
+                    Credential ecred = { 0 };
+                    if (credential_load_key(excludeCred.id.data, excludeCred.id.len, rp_id_hash, cred_key, &ecred) == 0) {
+                        if (ecred.extensions.credProtect == CRED_PROT_UV_REQUIRED) {
+                            excluded_uv = true;
+                        }
+                        else {
+                            excluded = true;
+                        }
+                    }
+                    credential_free(&ecred);
+                }
+            }
+            CBOR_FREE_BYTE_STRING(excludeCred.type);
+            CBOR_FREE_BYTE_STRING(excludeCred.id);
+        }
+        CBOR_PARSE_ARRAY_END(excludeList, 2);
+        mbedtls_platform_zeroize(cred_key, sizeof(cred_key));
+    }
 
     if (pinUvAuthParam.present == true) {
         if (pinUvAuthParam.len == 0 || pinUvAuthParam.data == NULL) {
@@ -279,22 +320,15 @@ int cbor_make_credential(const uint8_t *data, size_t len) {
         }
     }
 
-    for (size_t e = 0; e < excludeList_len; e++) { //12.1
-        if (excludeList[e].type.present == false || excludeList[e].id.present == false) {
-            CBOR_ERROR(CTAP2_ERR_MISSING_PARAMETER);
-        }
-        if (strcmp(excludeList[e].type.data, (char *)"public-key") != 0) {
-            continue;
-        }
-        Credential ecred;
-        if (credential_load(excludeList[e].id.data, excludeList[e].id.len, rp_id_hash,
-                            &ecred) == 0 &&
-            (ecred.extensions.credProtect != CRED_PROT_UV_REQUIRED ||
-             (flags & FIDO2_AUT_FLAG_UV))) {
-                credential_free(&ecred);
-            CBOR_ERROR(CTAP2_ERR_CREDENTIAL_EXCLUDED);
+    if (excludeList_invalid == true) { //12.1
+        CBOR_ERROR(CTAP2_ERR_MISSING_PARAMETER);
+    }
+    if (excluded == true || (excluded_uv == true && (flags & FIDO2_AUT_FLAG_UV))) {
+        // Wait for user presence, but report the exclusion whatever the outcome
+        if (pinUvAuthParam.present == false || getUserPresentFlagValue() == false) {
+            check_user_presence();
         }
-        credential_free(&ecred);
+        CBOR_ERROR(CTAP2_ERR_CREDENTIAL_EXCLUDED);
     }
 
     if (extensions.largeBlobKey == pfalse ||
@@ -318,8 +352,6 @@ int cbor_make_credential(const uint8_t *data, size_t len) {
         }
     }
 
-    const known_app_t *ka = find_app_by_rp_id_hash(rp_id_hash);
-
     uint8_t cred_id[MAX_CRED_ID_LENGTH] = {0};
     size_t cred_id_len = 0;
 
@@ -330,13 +362,9 @@ int cbor_make_credential(const uint8_t *data, size_t len) {
     if (getUserVerifiedFlagValue()) {
         flags |= FIDO2_AUT_FLAG_UV;
     }
-    size_t ext_len = 0;
-    uint8_t ext[512] = {0};
-    CborEncoder encoder, mapEncoder, mapEncoder2;
+    int l = 0;
+    uint8_t minPinLen = 0;
     if (extensions.present == true) {
-        cbor_encoder_init(&encoder, ext, sizeof(ext), 0);
-        int l = 0;
-        uint8_t minPinLen = 0;
         if (extensions.hmac_secret != NULL) {
             l++;
         }
@@ -344,112 +372,29 @@ int cbor_make_credential(const uint8_t *data, size_t len) {
             l++;
         }
         if (extensions.minPinLength != NULL) {
-            file_t *ef_minpin = search_by_fid(EF_MINPINLEN, NULL, SPECIFY_EF);
-            if (file_has_data(ef_minpin)) {
-                uint8_t *minpin_data = file_get_data(ef_minpin);
-                for (int o = 2; o < file_get_size(ef_minpin); o += 32) {
-                    if (memcmp(minpin_data + o, rp_id_hash, 32) == 0) {
-                        minPinLen = minpin_data[0];
-                        if (minPinLen > 0) {
-                            l++;
-                        }
-                        break;
-                    }
+            if (fido_conf_min_pin_rp(rp_id_hash)) {
+                minPinLen = fido_conf.min_pin_len;
+                if (minPinLen > 0) {
+                    l++;
                 }
             }
         }
         if (extensions.credBlob.present == true) {
             l++;
         }
-        CBOR_CHECK(cbor_encoder_create_map(&encoder, &mapEncoder, l));
-        if (extensions.credBlob.present == true) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder, "credBlob"));
-            CBOR_CHECK(cbor_encode_boolean(&mapEncoder, extensions.credBlob.len < MAX_CREDBLOB_LENGTH));
-        }
-        if (extensions.credProtect != 0) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder, "credProtect"));
-            CBOR_CHECK(cbor_encode_uint(&mapEncoder, extensions.credProtect));
-        }
-        if (extensions.hmac_secret != NULL) {
-
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder, "hmac-secret"));
-            CBOR_CHECK(cbor_encode_boolean(&mapEncoder, *extensions.hmac_secret));
-        }
-        if (minPinLen > 0) {
-
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder, "minPinLength"));
-            CBOR_CHECK(cbor_encode_uint(&mapEncoder, minPinLen));
-        }
-
-        CBOR_CHECK(cbor_encoder_close_container(&encoder, &mapEncoder));
-        ext_len = cbor_encoder_get_buffer_size(&encoder, ext);
         flags |= FIDO2_AUT_FLAG_ED;
     }
-    mbedtls_ecdsa_context ekey;
-    mbedtls_ecdsa_init(&ekey);
     int ret = fido_load_key(curve, cred_id, &ekey);
+    if (ret == CTAP2_ERR_KEEPALIVE_CANCEL) {
+        CBOR_ERROR(CTAP2_ERR_KEEPALIVE_CANCEL);
+    }
     if (ret != 0) {
-        mbedtls_ecdsa_free(&ekey);
         CBOR_ERROR(CTAP1_ERR_OTHER);
     }
     const mbedtls_ecp_curve_info *cinfo = mbedtls_ecp_curve_info_from_grp_id(ekey.grp.id);
     if (cinfo == NULL) {
-        mbedtls_ecdsa_free(&ekey);
         CBOR_ERROR(CTAP1_ERR_OTHER);
     }
-    size_t olen = 0;
-    uint32_t ctr = get_sign_counter();
-    uint8_t cbor_buf[1024] = {0};
-    cbor_encoder_init(&encoder, cbor_buf, sizeof(cbor_buf), 0);
-    CBOR_CHECK(COSE_key(&ekey, &encoder, &mapEncoder));
-    size_t rs = cbor_encoder_get_buffer_size(&encoder, cbor_buf);
-
-    size_t aut_data_len = 32 + 1 + 4 + (16 + 2 + cred_id_len + rs) + ext_len;
-    aut_data = (uint8_t *) calloc(1, aut_data_len + clientDataHash.len);
-    uint8_t *pa = aut_data;
-    memcpy(pa, rp_id_hash, 32); pa += 32;
-    *pa++ = flags;
-    *pa++ = (ctr >> 24) & 0xFF;
-    *pa++ = (ctr >> 16) & 0xFF;
-    *pa++ = (ctr >> 8) & 0xFF;
-    *pa++ = ctr & 0xFF;
-    memcpy(pa, aaguid, 16); pa += 16;
-    *pa++ = ((uint16_t)cred_id_len >> 8) & 0xFF;
-    *pa++ = (uint16_t)cred_id_len & 0xFF;
-    memcpy(pa, cred_id, cred_id_len); pa += (uint16_t)cred_id_len;
-    memcpy(pa, cbor_buf, rs); pa += (uint16_t)rs;
-    memcpy(pa, ext, ext_len); pa += (uint16_t)ext_len;
-    if ((size_t)(pa - aut_data) != aut_data_len) {
-        mbedtls_ecdsa_free(&ekey);
-        CBOR_ERROR(CTAP1_ERR_OTHER);
-    }
-
-    memcpy(pa, clientDataHash.data, clientDataHash.len);
-    uint8_t hash[64] = {0}, sig[MBEDTLS_ECDSA_MAX_LEN] = {0};
-    const mbedtls_md_info_t *md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
-    if (ekey.grp.id == MBEDTLS_ECP_DP_SECP384R1) {
-        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA384);
-    }
-    else if (ekey.grp.id == MBEDTLS_ECP_DP_SECP521R1) {
-        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA512);
-    }
-    ret = mbedtls_md(md, aut_data, aut_data_len + clientDataHash.len, hash);
-
-    bool self_attestation = true;
-    if (enterpriseAttestation == 2 || (ka && ka->use_self_attestation == pfalse)) {
-        mbedtls_ecdsa_free(&ekey);
-        mbedtls_ecdsa_init(&ekey);
-        uint8_t key[32] = {0};
-        if (load_keydev(key) != 0) {
-            CBOR_ERROR(CTAP1_ERR_OTHER);
-        }
-        ret = mbedtls_ecp_read_key(MBEDTLS_ECP_DP_SECP256R1, &ekey, key, 32);
-        mbedtls_platform_zeroize(key, sizeof(key));
-        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
-        self_attestation = false;
-    }
-    ret = mbedtls_ecdsa_write_signature(&ekey, mbedtls_md_get_type(md), hash, mbedtls_md_get_size(md), sig, sizeof(sig), &olen, random_gen, NULL);
-    mbedtls_ecdsa_free(&ekey);
 
     if (user.id.len > 0 && user.parent.name.len > 0 && user.displayName.len > 0) {
        if (memcmp(user.parent.name.data, "+pico", 5) == 0) {
@@ -478,13 +423,94 @@ int cbor_make_credential(const uint8_t *data, size_t len) {
         }
     }
 
+    CborEncoder encoder, mapEncoder, mapEncoder2;
     cbor_encoder_init(&encoder, ctap_resp->init.data + 1, CTAP_MAX_CBOR_PAYLOAD, 0);
     CBOR_CHECK(cbor_encoder_create_map(&encoder, &mapEncoder, extensions.largeBlobKey == ptrue && options.rk == ptrue ? 5 : 4));
 
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x01));
     CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder, "packed"));
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x02));
-    CBOR_CHECK(cbor_encode_byte_string(&mapEncoder, aut_data, aut_data_len));
+
+    uint8_t hash[64] = {0}, sig[MBEDTLS_ECDSA_MAX_LEN] = {0};
+    const mbedtls_md_info_t *md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    if (ekey.grp.id == MBEDTLS_ECP_DP_SECP384R1) {
+        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA384);
+    }
+    else if (ekey.grp.id == MBEDTLS_ECP_DP_SECP521R1) {
+        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA512);
+    }
+    uint32_t ctr = get_sign_counter();
+    uint8_t cred_id_len_be[2] = { ((uint16_t)cred_id_len >> 8) & 0xFF, (uint16_t)cred_id_len & 0xFF };
+    ret = auth_data_begin(&ad, &mapEncoder, ctap_resp->init.data + 1, CTAP_MAX_CBOR_PAYLOAD, md, rp_id_hash, flags, ctr);
+    if (ret == 0) {
+        ret = auth_data_put(&ad, aaguid, 16);
+    }
+    if (ret == 0) {
+        ret = auth_data_put(&ad, cred_id_len_be, sizeof(cred_id_len_be));
+    }
+    if (ret == 0) {
+        ret = auth_data_put(&ad, cred_id, cred_id_len);
+    }
+    if (ret != 0) {
+        CBOR_ERROR(CTAP1_ERR_OTHER);
+    }
+
+    CborEncoder autEncoder, autMapEncoder;
+    auth_data_encoder(&ad, &autEncoder);
+    CBOR_CHECK(COSE_key(&ekey, &autEncoder, &autMapEncoder));
+    if (auth_data_encoded(&ad, &autEncoder) != 0) {
+        CBOR_ERROR(CTAP1_ERR_OTHER);
+    }
+    if (extensions.present == true) {
+        auth_data_encoder(&ad, &autEncoder);
+        CBOR_CHECK(cbor_encoder_create_map(&autEncoder, &autMapEncoder, l));
+        if (extensions.credBlob.present == true) {
+            CBOR_CHECK(cbor_encode_text_stringz(&autMapEncoder, "credBlob"));
+            CBOR_CHECK(cbor_encode_boolean(&autMapEncoder, extensions.credBlob.len < MAX_CREDBLOB_LENGTH));
+        }
+        if (extensions.credProtect != 0) {
+            CBOR_CHECK(cbor_encode_text_stringz(&autMapEncoder, "credProtect"));
+            CBOR_CHECK(cbor_encode_uint(&autMapEncoder, extensions.credProtect));
+        }
+        if (extensions.hmac_secret != NULL) {
+
+            CBOR_CHECK(cbor_encode_text_stringz(&autMapEncoder, "hmac-secret"));
+            CBOR_CHECK(cbor_encode_boolean(&autMapEncoder, *extensions.hmac_secret));
+        }
+        if (minPinLen > 0) {
+
+            CBOR_CHECK(cbor_encode_text_stringz(&autMapEncoder, "minPinLength"));
+            CBOR_CHECK(cbor_encode_uint(&autMapEncoder, minPinLen));
+        }
+        CBOR_CHECK(cbor_encoder_close_container(&autEncoder, &autMapEncoder));
+        if (auth_data_encoded(&ad, &autEncoder) != 0) {
+            CBOR_ERROR(CTAP1_ERR_OTHER);
+        }
+    }
+    if (auth_data_end(&ad, &mapEncoder, clientDataHash.data, clientDataHash.len, hash) != 0) {
+        CBOR_ERROR(CTAP1_ERR_OTHER);
+    }
+
+    bool self_attestation = true;
+    if (enterpriseAttestation == 2 || (ka && ka->use_self_attestation == pfalse)) {
+        mbedtls_ecdsa_free(&ekey);
+        mbedtls_ecdsa_init(&ekey);
+        uint8_t key[32] = {0};
+        if (load_keydev(key) != 0) {
+            CBOR_ERROR(CTAP1_ERR_OTHER);
+        }
+        ret = mbedtls_ecp_read_key(MBEDTLS_ECP_DP_SECP256R1, &ekey, key, 32);
+        mbedtls_platform_zeroize(key, sizeof(key));
+        md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+        self_attestation = false;
+    }
+    size_t olen = 0;
+    ret = mbedtls_ecdsa_write_signature(&ekey, mbedtls_md_get_type(md), hash, mbedtls_md_get_size(md), sig, sizeof(sig), &olen, random_gen, NULL);
+    mbedtls_ecdsa_free(&ekey);
+    if (ret != 0) {
+        CBOR_ERROR(CTAP2_ERR_PROCESSING);
+    }
+
     CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x03));
 
     CBOR_CHECK(cbor_encoder_create_map(&mapEncoder, &mapEncoder2, self_attestation == false || is_nitrokey ? 3 : 2));
@@ -542,16 +568,11 @@ err:
         CBOR_FREE_BYTE_STRING(pubKeyCredParams[n].type);
     }
 
-    for (size_t m = 0; m < MAX_CREDENTIAL_COUNT_IN_LIST; m++) {
-        CBOR_FREE_BYTE_STRING(excludeList[m].type);
-        CBOR_FREE_BYTE_STRING(excludeList[m].id);
-        for (size_t n = 0; n < excludeList[m].transports_len; n++) {
-            CBOR_FREE_BYTE_STRING(excludeList[m].transports[n]);
-        }
-    }
-    if (aut_data) {
-        free(aut_data);
-    }
+    CBOR_FREE_BYTE_STRING(excludeCred.type);
+    CBOR_FREE_BYTE_STRING(excludeCred.id);
+    mbedtls_platform_zeroize(cred_key, sizeof(cred_key));
+    mbedtls_ecdsa_free(&ekey);
+    auth_data_free(&ad);
     if (error != CborNoError) {
         if (error == CborErrorImproperValue) {
             return CTAP2_ERR_CBOR_UNEXPECTED_TYPE;
@@ -21,6 +21,7 @@
 #include "ctap.h"
 #include "random.h"
 #include "files.h"
+#include "hash.h"
 #include "hid/ctap_hid.h"
 #include "management.h"
 
@@ -95,7 +96,7 @@ int cmd_register() {
     memcpy(sign_base + 1 + CTAP_APPID_SIZE, req->chal, CTAP_CHAL_SIZE);
     memcpy(sign_base + 1 + CTAP_APPID_SIZE + CTAP_CHAL_SIZE, resp->keyHandleCertSig, KEY_HANDLE_LEN);
     memcpy(sign_base + 1 + CTAP_APPID_SIZE + CTAP_CHAL_SIZE + KEY_HANDLE_LEN, (uint8_t *) &resp->pubKey, CTAP_EC_POINT_SIZE);
-    ret = mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), sign_base, sizeof(sign_base), hash);
+    ret = hash_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), sign_base, sizeof(sign_base), hash);
     if (ret != 0) {
         return SW_EXEC_ERROR();
     }
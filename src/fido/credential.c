@@ -16,7 +16,9 @@
  */
 
 #include "mbedtls/chachapoly.h"
-#include "mbedtls/sha256.h"
+#include "mbedtls/chacha20.h"
+#include "mbedtls/poly1305.h"
+#include "hash.h"
 #include "credential.h"
 #if !defined(ENABLE_EMULATION) && !defined(ESP_PLATFORM)
 #include "bsp/board.h"
@@ -28,16 +30,11 @@
 #include "files.h"
 #include "pico_keys.h"
 
-int credential_derive_chacha_key(uint8_t *outk);
-
-int credential_verify(uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash) {
+static int credential_decrypt(uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash, const uint8_t *key) {
     if (cred_id_len < 4 + 12 + 16) {
         return -1;
     }
-    uint8_t key[32], *iv = cred_id + 4, *cipher = cred_id + 4 + 12,
-            *tag = cred_id + cred_id_len - 16;
-    memset(key, 0, sizeof(key));
-    credential_derive_chacha_key(key);
+    uint8_t *iv = cred_id + 4, *cipher = cred_id + 4 + 12, *tag = cred_id + cred_id_len - 16;
     mbedtls_chachapoly_context chatx;
     mbedtls_chachapoly_init(&chatx);
     mbedtls_chachapoly_setkey(&chatx, key);
@@ -46,6 +43,142 @@ int credential_verify(uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id
     return ret;
 }
 
+int credential_verify(uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash) {
+    uint8_t key[32];
+    memset(key, 0, sizeof(key));
+    credential_derive_chacha_key(key);
+    int ret = credential_decrypt(cred_id, cred_id_len, rp_id_hash, key);
+    mbedtls_platform_zeroize(key, sizeof(key));
+    return ret;
+}
+
+/*
+ * Tells whether a credential id was issued by this authenticator for the RP
+ * without decrypting it: the CRED_PROTO prefix is checked and the Poly1305
+ * tag is recomputed over (rp_id_hash, ciphertext), as the AEAD would do. No
+ * copy is made and nothing is parsed, so it is cheap enough to run over long
+ * excludeLists. key comes from credential_derive_chacha_key(), derived once by
+ * the caller for the whole list. U2F key handles go through verify_key().
+ */
+int credential_verify_tag(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash, const uint8_t *key) {
+    bool proto = cred_id_len >= 4 &&
+                 (memcmp(cred_id, CRED_PROTO, 4) == 0 || memcmp(cred_id, CRED_PROTO_CBOR, 4) == 0);
+    if (cred_id_len == KEY_HANDLE_LEN && proto == false) {
+        return verify_key(rp_id_hash, cred_id, NULL);
+    }
+    if (cred_id_len < 4 + 12 + 16 || proto == false) {
+        return -1;
+    }
+    const uint8_t *iv = cred_id + 4, *cipher = cred_id + 4 + 12, *tag = cred_id + cred_id_len - 16;
+    size_t cipher_len = cred_id_len - (4 + 12 + 16);
+    uint8_t otk[32], mac[16], pad[16] = { 0 }, lens[16] = { 0 };
+    // The one-time Poly1305 key is the first ChaCha20 block (RFC 8439, 2.6)
+    memset(otk, 0, sizeof(otk));
+    int ret = mbedtls_chacha20_crypt(key, iv, 0, sizeof(otk), otk, otk);
+    if (ret != 0) {
+        return ret;
+    }
+    lens[0] = 32;
+    for (int i = 0; i < 8; i++) {
+        lens[8 + i] = (uint8_t)((uint64_t)cipher_len >> (8 * i));
+    }
+    mbedtls_poly1305_context ctx;
+    mbedtls_poly1305_init(&ctx);
+    ret = mbedtls_poly1305_starts(&ctx, otk);
+    if (ret == 0) {
+        ret = mbedtls_poly1305_update(&ctx, rp_id_hash, 32);
+    }
+    if (ret == 0) {
+        ret = mbedtls_poly1305_update(&ctx, cipher, cipher_len);
+    }
+    if (ret == 0 && (cipher_len % 16) != 0) {
+        ret = mbedtls_poly1305_update(&ctx, pad, 16 - (cipher_len % 16));
+    }
+    if (ret == 0) {
+        ret = mbedtls_poly1305_update(&ctx, lens, sizeof(lens));
+    }
+    if (ret == 0) {
+        ret = mbedtls_poly1305_finish(&ctx, mac);
+    }
+    mbedtls_poly1305_free(&ctx);
+    mbedtls_platform_zeroize(otk, sizeof(otk));
+    if (ret != 0) {
+        return ret;
+    }
+    uint8_t diff = 0;
+    for (int i = 0; i < 16; i++) {
+        diff |= mac[i] ^ tag[i];
+    }
+    return diff == 0 ? 0 : -1;
+}
+
+/*
+ * Credentials issued with CRED_PROTO are encrypted in a compact binary layout:
+ *
+ *   0  creation       4 bytes, big endian
+ *   4  flags          2 bytes, big endian (CRED_CF_*)
+ *   6  credProtect    1 byte
+ *   7  alg            2 bytes, big endian two's complement
+ *   9  curve          1 byte
+ *  10  fields         tag (1) | length (1) | value, for the strings present
+ *
+ * The rp_id_hash is not stored, as it is the associated data of the AEAD, and
+ * the rpId string is only kept for resident credentials.
+ *
+ * Field tags reuse the keys of the CBOR map of CRED_PROTO_CBOR ids, which are
+ * still accepted by credential_load(). Both formats share the same keys, so
+ * the derivations below are bound to the CRED_PROTO_CBOR prefix.
+ */
+#define CRED_HDR_LEN            10
+
+#define CRED_CF_SIGN_COUNT      0x0001
+#define CRED_CF_EXT             0x0002
+#define CRED_CF_HMAC_SECRET     0x0004
+#define CRED_CF_HMAC_SECRET_ON  0x0008
+#define CRED_CF_LARGE_BLOB_KEY  0x0010
+#define CRED_CF_THIRD_PARTY     0x0020
+#define CRED_CF_OPTS            0x0040
+#define CRED_CF_RK              0x0080
+#define CRED_CF_RK_ON           0x0100
+
+#define CRED_TAG_RP_ID          0x01
+#define CRED_TAG_USER_ID        0x03
+#define CRED_TAG_USER_NAME      0x04
+#define CRED_TAG_USER_DISPLAY   0x05
+#define CRED_TAG_CRED_BLOB      0x07
+
+static int credential_put_field(uint8_t *buf, size_t *off, size_t max, uint8_t tag, const void *data, size_t len) {
+    if (data == NULL || len == 0) {
+        return 0;
+    }
+    if (len > 0xFF || *off + 2 + len > max) {
+        return -1;
+    }
+    buf[(*off)++] = tag;
+    buf[(*off)++] = (uint8_t)len;
+    memcpy(buf + *off, data, len);
+    *off += len;
+    return 0;
+}
+
+/*
+ * CTAP 2.1 lets the authenticator truncate user.name and user.displayName to
+ * 64 bytes. The cut is moved back to the start of a UTF-8 sequence so the
+ * stored string stays valid.
+ */
+#define CRED_USER_FIELD_MAX     64
+
+static size_t credential_user_field_len(const CborCharString *s) {
+    size_t len = s->len;
+    if (len > CRED_USER_FIELD_MAX) {
+        len = CRED_USER_FIELD_MAX;
+        while (len > 0 && ((uint8_t) s->data[len] & 0xC0) == 0x80) {
+            len--;
+        }
+    }
+    return len;
+}
+
 int credential_create(CborCharString *rpId,
                       CborByteString *userId,
                       CborCharString *userName,
@@ -57,62 +190,55 @@ int credential_create(CborCharString *rpId,
                       int curve,
                       uint8_t *cred_id,
                       size_t *cred_id_len) {
-    CborEncoder encoder, mapEncoder, mapEncoder2;
-    CborError error = CborNoError;
     uint8_t rp_id_hash[32];
-    mbedtls_sha256((uint8_t *) rpId->data, rpId->len, rp_id_hash, 0);
-    cbor_encoder_init(&encoder, cred_id + 4 + 12, MAX_CRED_ID_LENGTH - (4 + 12 + 16), 0);
-    CBOR_CHECK(cbor_encoder_create_map(&encoder, &mapEncoder,  CborIndefiniteLength));
-    CBOR_APPEND_KEY_UINT_VAL_STRING(mapEncoder, 0x01, *rpId);
-    CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x02));
-    CBOR_CHECK(cbor_encode_byte_string(&mapEncoder, rp_id_hash, 32));
-    CBOR_APPEND_KEY_UINT_VAL_BYTES(mapEncoder, 0x03, *userId);
-    CBOR_APPEND_KEY_UINT_VAL_STRING(mapEncoder, 0x04, *userName);
-    CBOR_APPEND_KEY_UINT_VAL_STRING(mapEncoder, 0x05, *userDisplayName);
-    CBOR_APPEND_KEY_UINT_VAL_UINT(mapEncoder, 0x06, board_millis());
+    hash_sha256((uint8_t *) rpId->data, rpId->len, rp_id_hash);
+    uint8_t *pt = cred_id + 4 + 12;
+    size_t max = MAX_CRED_ID_LENGTH - (4 + 12 + 16), rs = CRED_HDR_LEN;
+    uint16_t cf = use_sign_count ? CRED_CF_SIGN_COUNT : 0;
+    uint32_t creation = board_millis();
+    memset(pt, 0, CRED_HDR_LEN);
     if (extensions->present == true) {
-        CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x07));
-        CBOR_CHECK(cbor_encoder_create_map(&mapEncoder, &mapEncoder2,  CborIndefiniteLength));
-        if (extensions->credBlob.present == true &&
-            extensions->credBlob.len < MAX_CREDBLOB_LENGTH) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "credBlob"));
-            CBOR_CHECK(cbor_encode_byte_string(&mapEncoder2, extensions->credBlob.data, extensions->credBlob.len));
-        }
-        if (extensions->credProtect != 0) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "credProtect"));
-            CBOR_CHECK(cbor_encode_uint(&mapEncoder2, extensions->credProtect));
-        }
+        cf |= CRED_CF_EXT;
         if (extensions->hmac_secret != NULL) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "hmac-secret"));
-            CBOR_CHECK(cbor_encode_boolean(&mapEncoder2, *extensions->hmac_secret));
+            cf |= CRED_CF_HMAC_SECRET | (*extensions->hmac_secret ? CRED_CF_HMAC_SECRET_ON : 0);
         }
         if (extensions->largeBlobKey == ptrue) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "largeBlobKey"));
-            CBOR_CHECK(cbor_encode_boolean(&mapEncoder2, true));
+            cf |= CRED_CF_LARGE_BLOB_KEY;
         }
         if (extensions->thirdPartyPayment == ptrue) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "thirdPartyPayment"));
-            CBOR_CHECK(cbor_encode_boolean(&mapEncoder2, true));
+            cf |= CRED_CF_THIRD_PARTY;
         }
-        CBOR_CHECK(cbor_encoder_close_container(&mapEncoder, &mapEncoder2));
-    }
-    CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x08));
-    CBOR_CHECK(cbor_encode_boolean(&mapEncoder, use_sign_count));
-    if (alg != FIDO2_ALG_ES256 || curve != FIDO2_CURVE_P256) {
-        CBOR_APPEND_KEY_UINT_VAL_INT(mapEncoder, 0x09, alg);
-        CBOR_APPEND_KEY_UINT_VAL_INT(mapEncoder, 0x0A, curve);
+        pt[6] = (uint8_t)extensions->credProtect;
     }
     if (opts->present == true) {
-        CBOR_CHECK(cbor_encode_uint(&mapEncoder, 0x0B));
-        CBOR_CHECK(cbor_encoder_create_map(&mapEncoder, &mapEncoder2,  CborIndefiniteLength));
+        cf |= CRED_CF_OPTS;
         if (opts->rk != NULL) {
-            CBOR_CHECK(cbor_encode_text_stringz(&mapEncoder2, "rk"));
-            CBOR_CHECK(cbor_encode_boolean(&mapEncoder2, opts->rk == ptrue));
+            cf |= CRED_CF_RK | (opts->rk == ptrue ? CRED_CF_RK_ON : 0);
         }
-        CBOR_CHECK(cbor_encoder_close_container(&mapEncoder, &mapEncoder2));
     }
-    CBOR_CHECK(cbor_encoder_close_container(&encoder, &mapEncoder));
-    size_t rs = cbor_encoder_get_buffer_size(&encoder, cred_id);
+    pt[0] = creation >> 24;
+    pt[1] = (creation >> 16) & 0xFF;
+    pt[2] = (creation >> 8) & 0xFF;
+    pt[3] = creation & 0xFF;
+    pt[4] = cf >> 8;
+    pt[5] = cf & 0xFF;
+    pt[7] = ((uint16_t)(int16_t)alg) >> 8;
+    pt[8] = ((uint16_t)(int16_t)alg) & 0xFF;
+    pt[9] = (uint8_t)curve;
+    // Only resident credentials are listed by RP, others are always looked up
+    // with the rpId of the request
+    bool resident = opts->present == true && opts->rk == ptrue;
+    if ((resident && credential_put_field(pt, &rs, max, CRED_TAG_RP_ID, rpId->data, rpId->len) != 0) ||
+        credential_put_field(pt, &rs, max, CRED_TAG_USER_ID, userId->data, userId->len) != 0 ||
+        credential_put_field(pt, &rs, max, CRED_TAG_USER_NAME, userName->data, credential_user_field_len(userName)) != 0 ||
+        credential_put_field(pt, &rs, max, CRED_TAG_USER_DISPLAY, userDisplayName->data, credential_user_field_len(userDisplayName)) != 0) {
+        return CTAP2_ERR_REQUEST_TOO_LARGE;
+    }
+    if (extensions->present == true && extensions->credBlob.present == true &&
+        extensions->credBlob.len < MAX_CREDBLOB_LENGTH &&
+        credential_put_field(pt, &rs, max, CRED_TAG_CRED_BLOB, extensions->credBlob.data, extensions->credBlob.len) != 0) {
+        return CTAP2_ERR_REQUEST_TOO_LARGE;
+    }
     *cred_id_len = 4 + 12 + rs + 16;
     uint8_t key[32];
     memset(key, 0, sizeof(key));
@@ -122,38 +248,108 @@ int credential_create(CborCharString *rpId,
     mbedtls_chachapoly_context chatx;
     mbedtls_chachapoly_init(&chatx);
     mbedtls_chachapoly_setkey(&chatx, key);
-    int ret = mbedtls_chachapoly_encrypt_and_tag(&chatx, rs, iv, rp_id_hash, 32,
-                                                 cred_id + 4 + 12,
-                                                 cred_id + 4 + 12,
-                                                 cred_id + 4 + 12 + rs);
+    int ret = mbedtls_chachapoly_encrypt_and_tag(&chatx, rs, iv, rp_id_hash, 32, pt, pt, pt + rs);
     mbedtls_chachapoly_free(&chatx);
     if (ret != 0) {
-        CBOR_ERROR(CTAP1_ERR_OTHER);
+        return CTAP1_ERR_OTHER;
     }
     memcpy(cred_id, CRED_PROTO, 4);
     memcpy(cred_id + 4, iv, 12);
+    return 0;
+}
 
-err:
-    if (error != CborNoError) {
-        if (error == CborErrorImproperValue) {
-            return CTAP2_ERR_CBOR_UNEXPECTED_TYPE;
+static int credential_dup_field(const uint8_t *data, size_t len, CborByteString *v) {
+    v->data = (uint8_t *) calloc(1, len + 1);
+    if (v->data == NULL) {
+        return -1;
+    }
+    memcpy(v->data, data, len);
+    v->len = len;
+    v->present = true;
+    return 0;
+}
+
+static int credential_parse_compact(const uint8_t *pt, size_t pt_len, Credential *cred) {
+    if (pt_len < CRED_HDR_LEN) {
+        return CTAP2_ERR_INVALID_CREDENTIAL;
+    }
+    uint16_t cf = (pt[4] << 8) | pt[5];
+    cred->creation = ((uint32_t)pt[0] << 24) | (pt[1] << 16) | (pt[2] << 8) | pt[3];
+    cred->use_sign_count = cf & CRED_CF_SIGN_COUNT ? ptrue : pfalse;
+    cred->alg = (int16_t)((pt[7] << 8) | pt[8]);
+    cred->curve = pt[9];
+    if (cf & CRED_CF_EXT) {
+        cred->extensions.present = true;
+        cred->extensions.credProtect = pt[6];
+        if (cf & CRED_CF_HMAC_SECRET) {
+            cred->extensions.hmac_secret = cf & CRED_CF_HMAC_SECRET_ON ? ptrue : pfalse;
+        }
+        if (cf & CRED_CF_LARGE_BLOB_KEY) {
+            cred->extensions.largeBlobKey = ptrue;
+        }
+        if (cf & CRED_CF_THIRD_PARTY) {
+            cred->extensions.thirdPartyPayment = ptrue;
+        }
+    }
+    if (cf & CRED_CF_OPTS) {
+        cred->opts.present = true;
+        if (cf & CRED_CF_RK) {
+            cred->opts.rk = cf & CRED_CF_RK_ON ? ptrue : pfalse;
         }
-        return error;
+    }
+    for (size_t off = CRED_HDR_LEN; off < pt_len;) {
+        if (off + 2 > pt_len || off + 2 + pt[off + 1] > pt_len) {
+            return CTAP2_ERR_INVALID_CREDENTIAL;
+        }
+        uint8_t tag = pt[off], len = pt[off + 1];
+        const uint8_t *v = pt + off + 2;
+        int ret = 0;
+        if (tag == CRED_TAG_RP_ID) {
+            ret = credential_dup_field(v, len, (CborByteString *) &cred->rpId);
+        }
+        else if (tag == CRED_TAG_USER_ID) {
+            ret = credential_dup_field(v, len, &cred->userId);
+        }
+        else if (tag == CRED_TAG_USER_NAME) {
+            ret = credential_dup_field(v, len, (CborByteString *) &cred->userName);
+        }
+        else if (tag == CRED_TAG_USER_DISPLAY) {
+            ret = credential_dup_field(v, len, (CborByteString *) &cred->userDisplayName);
+        }
+        else if (tag == CRED_TAG_CRED_BLOB) {
+            ret = credential_dup_field(v, len, &cred->extensions.credBlob);
+        }
+        if (ret != 0) {
+            return CTAP2_ERR_PROCESSING;
+        }
+        off += 2 + len;
     }
     return 0;
 }
 
-int credential_load(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash, Credential *cred) {
+/*
+ * Same as credential_load() with the key of credential_derive_chacha_key()
+ * already derived, for callers that load several credentials in a row.
+ */
+int credential_load_key(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash, const uint8_t *key, Credential *cred) {
     int ret = 0;
     CborError error = CborNoError;
     uint8_t *copy_cred_id = (uint8_t *) calloc(1, cred_id_len);
     memcpy(copy_cred_id, cred_id, cred_id_len);
-    ret = credential_verify(copy_cred_id, cred_id_len, rp_id_hash);
+    ret = credential_decrypt(copy_cred_id, cred_id_len, rp_id_hash, key);
     if (ret != 0) { // U2F?
         if (cred_id_len != KEY_HANDLE_LEN || verify_key(rp_id_hash, cred_id, NULL) != 0) {
             CBOR_ERROR(CTAP2_ERR_INVALID_CREDENTIAL);
         }
     }
+    else if (memcmp(cred_id, CRED_PROTO, 4) == 0) {
+        memset(cred, 0, sizeof(Credential));
+        ret = credential_parse_compact(copy_cred_id + 4 + 12, cred_id_len - (4 + 12 + 16), cred);
+        if (ret != 0) {
+            credential_free(cred);
+            CBOR_ERROR(ret);
+        }
+    }
     else {
         CborParser parser;
         CborValue map;
@@ -235,6 +431,15 @@ err:
     return 0;
 }
 
+int credential_load(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash, Credential *cred) {
+    uint8_t key[32];
+    memset(key, 0, sizeof(key));
+    credential_derive_chacha_key(key);
+    int ret = credential_load_key(cred_id, cred_id_len, rp_id_hash, key, cred);
+    mbedtls_platform_zeroize(key, sizeof(key));
+    return ret;
+}
+
 void credential_free(Credential *cred) {
     CBOR_FREE_BYTE_STRING(cred->rpId);
     CBOR_FREE_BYTE_STRING(cred->userId);
@@ -249,34 +454,181 @@ void credential_free(Credential *cred) {
     cred->opts.present = false;
 }
 
+/*
+ * RAM index over the resident credential slots, rebuilt by scan_files().
+ *
+ * id_tag holds four bytes of the credential id nonce and rp_slot points to the
+ * EF_RP slot of the credential, so credMgmt finds a credential and its RP
+ * without walking the files. Both are read from the plaintext slot header.
+ *
+ * The userId of a credential is only readable after decrypting it, so its keyed
+ * fingerprint is filled lazily: the first credential_store() for an RP decrypts
+ * the slots of that RP that have none yet, and the slot is refreshed whenever
+ * it is loaded (credential_store, getAssertion) or written. Afterwards,
+ * duplicate detection only decrypts the slot whose fingerprint matches. Boot
+ * does not decrypt any credential.
+ *
+ * Credential ids are looked up through a chained hash on id_tag: cred_bucket
+ * holds the first slot + 1 of each chain and next the following one. The tag
+ * comes from the random nonce, so its low bits spread the slots evenly. A
+ * deleted slot stays chained until the slot is reused; lookups skip it because
+ * its bit in cred_used is clear.
+ */
+#define CRED_INDEX_USER     0x01
+#define CRED_INDEX_RP       0x02
+#define CRED_INDEX_ID       0x04
+
+#define CRED_INDEX_BUCKETS  MAX_RESIDENT_CREDENTIALS
+
+typedef struct cred_index {
+    uint32_t id_tag;
+    uint32_t user_fp;
+    uint16_t next;
+    uint8_t rp_slot;
+    uint8_t flags;
+} cred_index_t;
+
+static cred_index_t cred_index[MAX_RESIDENT_CREDENTIALS];
+static uint16_t cred_bucket[CRED_INDEX_BUCKETS];
+static uint8_t user_fp_key[32];
+
+static uint32_t credential_id_tag(const uint8_t *cred_id, size_t cred_id_len) {
+    uint32_t tag = 0;
+    if (cred_id_len >= 4 + sizeof(tag)) {
+        memcpy(&tag, cred_id + 4, sizeof(tag));
+    }
+    return tag;
+}
+
+static void credential_index_unlink(uint16_t slot) {
+    if (!(cred_index[slot].flags & CRED_INDEX_ID)) {
+        return;
+    }
+    uint16_t *p = &cred_bucket[cred_index[slot].id_tag % CRED_INDEX_BUCKETS];
+    while (*p != 0 && *p != slot + 1) {
+        p = &cred_index[*p - 1].next;
+    }
+    if (*p == slot + 1) {
+        *p = cred_index[slot].next;
+    }
+    cred_index[slot].next = 0;
+    cred_index[slot].flags &= ~CRED_INDEX_ID;
+}
+
+static void credential_index_set_id(uint16_t slot, uint32_t id_tag) {
+    credential_index_unlink(slot);
+    uint16_t *head = &cred_bucket[id_tag % CRED_INDEX_BUCKETS];
+    cred_index[slot].id_tag = id_tag;
+    cred_index[slot].next = *head;
+    cred_index[slot].flags |= CRED_INDEX_ID;
+    *head = slot + 1;
+}
+
+static void credential_index_set_rp(uint16_t slot, const uint8_t *rp_id_hash) {
+    cred_index[slot].flags &= ~CRED_INDEX_RP;
+    for (uint16_t j = 0; j < MAX_RESIDENT_CREDENTIALS; j++) {
+        if (slot_map_used(rp_used, j) && file_has_data(rp_slots[j]) && memcmp(file_get_data(rp_slots[j]) + 1, rp_id_hash, 32) == 0) {
+            cred_index[slot].rp_slot = (uint8_t)j;
+            cred_index[slot].flags |= CRED_INDEX_RP;
+            return;
+        }
+    }
+}
+
+void credential_index_reset() {
+    memset(cred_index, 0, sizeof(cred_index));
+    memset(cred_bucket, 0, sizeof(cred_bucket));
+    random_gen(NULL, user_fp_key, sizeof(user_fp_key));
+    for (uint16_t i = 0; i < MAX_RESIDENT_CREDENTIALS; i++) {
+        file_t *ef = cred_slots[i];
+        if (!slot_map_used(cred_used, i) || !file_has_data(ef) || file_get_size(ef) < 32) {
+            continue;
+        }
+        credential_index_set_id(i, credential_id_tag(file_get_data(ef) + 32, file_get_size(ef) - 32));
+        if (i > 0 && (cred_index[i - 1].flags & CRED_INDEX_RP) && file_has_data(cred_slots[i - 1]) &&
+            memcmp(file_get_data(cred_slots[i - 1]), file_get_data(ef), 32) == 0) {
+            cred_index[i].rp_slot = cred_index[i - 1].rp_slot;
+            cred_index[i].flags |= CRED_INDEX_RP;
+        }
+        else {
+            credential_index_set_rp(i, file_get_data(ef));
+        }
+    }
+}
+
+int credential_index_find(const uint8_t *cred_id, size_t cred_id_len) {
+    uint32_t tag = credential_id_tag(cred_id, cred_id_len);
+    for (uint16_t n = cred_bucket[tag % CRED_INDEX_BUCKETS]; n != 0; n = cred_index[n - 1].next) {
+        uint16_t i = n - 1;
+        if (!slot_map_used(cred_used, i) || cred_index[i].id_tag != tag) {
+            continue;
+        }
+        file_t *ef = cred_slots[i];
+        if (file_has_data(ef) && file_get_size(ef) == cred_id_len + 32 && memcmp(file_get_data(ef) + 32, cred_id, cred_id_len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int credential_index_rp_slot(uint16_t slot) {
+    if (slot >= MAX_RESIDENT_CREDENTIALS || !(cred_index[slot].flags & CRED_INDEX_RP)) {
+        return -1;
+    }
+    return cred_index[slot].rp_slot;
+}
+
+static uint32_t credential_user_fp(const CborByteString *userId) {
+    uint8_t hmac[32];
+    uint32_t fp = 0;
+    hash_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), user_fp_key, sizeof(user_fp_key), userId->data, userId->len, hmac);
+    memcpy(&fp, hmac, sizeof(fp));
+    return fp;
+}
+
+void credential_index_put(uint16_t slot, const Credential *cred) {
+    if (slot >= MAX_RESIDENT_CREDENTIALS) {
+        return;
+    }
+    cred_index[slot].user_fp = credential_user_fp(&cred->userId);
+    cred_index[slot].flags |= CRED_INDEX_USER;
+}
+
+static bool credential_same_user(const Credential *a, const Credential *b) {
+    return a->userId.len == b->userId.len && memcmp(a->userId.data, b->userId.data, a->userId.len) == 0;
+}
+
 int credential_store(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash) {
     int sloti = -1;
     Credential cred = { 0 };
     int ret = 0;
     bool new_record = true;
-    ret = credential_load(cred_id, cred_id_len, rp_id_hash, &cred);
+    uint8_t key[32];
+    memset(key, 0, sizeof(key));
+    credential_derive_chacha_key(key);
+    ret = credential_load_key(cred_id, cred_id_len, rp_id_hash, key, &cred);
     if (ret != 0) {
+        mbedtls_platform_zeroize(key, sizeof(key));
         credential_free(&cred);
         return ret;
     }
+    uint32_t user_fp = credential_user_fp(&cred.userId);
     for (uint16_t i = 0; i < MAX_RESIDENT_CREDENTIALS; i++) {
-        file_t *ef = search_dynamic_file(EF_CRED + i);
+        file_t *ef = cred_slots[i];
         Credential rcred = { 0 };
-        if (!file_has_data(ef)) {
-            if (sloti == -1) {
-                sloti = i;
-            }
+        if (!slot_map_used(cred_used, i) || !file_has_data(ef) || memcmp(file_get_data(ef), rp_id_hash, 32) != 0) {
             continue;
         }
-        if (memcmp(file_get_data(ef), rp_id_hash, 32) != 0) {
+        if ((cred_index[i].flags & CRED_INDEX_USER) && cred_index[i].user_fp != user_fp) {
             continue;
         }
-        ret = credential_load(file_get_data(ef) + 32, file_get_size(ef) - 32, rp_id_hash, &rcred);
+        ret = credential_load_key(file_get_data(ef) + 32, file_get_size(ef) - 32, rp_id_hash, key, &rcred);
         if (ret != 0) {
             credential_free(&rcred);
             continue;
         }
-        if (memcmp(rcred.userId.data, cred.userId.data, MIN(rcred.userId.len, cred.userId.len)) == 0) {
+        credential_index_put(i, &rcred);
+        if (credential_same_user(&rcred, &cred)) {
             sloti = i;
             credential_free(&rcred);
             new_record = false;
@@ -284,35 +636,46 @@ int credential_store(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *
         }
         credential_free(&rcred);
     }
+    mbedtls_platform_zeroize(key, sizeof(key));
     if (sloti == -1) {
+        sloti = slot_map_first_free(cred_used, MAX_RESIDENT_CREDENTIALS);
+    }
+    if (sloti == -1) {
+        credential_free(&cred);
         return -1;
     }
     uint8_t *data = (uint8_t *) calloc(1, cred_id_len + 32);
     memcpy(data, rp_id_hash, 32);
     memcpy(data + 32, cred_id, cred_id_len);
-    file_t *ef = file_new((uint16_t)(EF_CRED + sloti));
+    file_t *ef = slot_file_new((uint16_t)(EF_CRED + sloti));
     file_put_data(ef, data, (uint16_t)cred_id_len + 32);
     free(data);
+    uint16_t cred_slot = (uint16_t)sloti;
+    if (new_record == true) {
+        cred_index[cred_slot].flags &= CRED_INDEX_ID;
+    }
+    credential_index_set_id(cred_slot, credential_id_tag(cred_id, cred_id_len));
+    cred_index[cred_slot].user_fp = user_fp;
+    cred_index[cred_slot].flags |= CRED_INDEX_USER;
 
     if (new_record == true) { //increase rps
         sloti = -1;
         for (uint16_t i = 0; i < MAX_RESIDENT_CREDENTIALS; i++) {
-            ef = search_dynamic_file(EF_RP + i);
-            if (!file_has_data(ef)) {
-                if (sloti == -1) {
-                    sloti = i;
-                }
-                continue;
-            }
-            if (memcmp(file_get_data(ef) + 1, rp_id_hash, 32) == 0) {
+            if (slot_map_used(rp_used, i) && file_has_data(rp_slots[i]) && memcmp(file_get_data(rp_slots[i]) + 1, rp_id_hash, 32) == 0) {
                 sloti = i;
                 break;
             }
         }
         if (sloti == -1) {
+            sloti = slot_map_first_free(rp_used, MAX_RESIDENT_CREDENTIALS);
+        }
+        if (sloti == -1) {
+            credential_free(&cred);
             return -1;
         }
-        ef = search_dynamic_file((uint16_t)(EF_RP + sloti));
+        cred_index[cred_slot].rp_slot = (uint8_t)sloti;
+        cred_index[cred_slot].flags |= CRED_INDEX_RP;
+        ef = rp_slots[sloti];
         if (file_has_data(ef)) {
             data = (uint8_t *) calloc(1, file_get_size(ef));
             memcpy(data, file_get_data(ef), file_get_size(ef));
@@ -321,7 +684,7 @@ int credential_store(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *
             free(data);
         }
         else {
-            ef = file_new((uint16_t)(EF_RP + sloti));
+            ef = slot_file_new((uint16_t)(EF_RP + sloti));
             data = (uint8_t *) calloc(1, 1 + 32 + cred.rpId.len);
             data[0] = 1;
             memcpy(data + 1, rp_id_hash, 32);
@@ -331,10 +694,52 @@ int credential_store(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *
         }
     }
     credential_free(&cred);
+    rp_info_set_resident(rp_id_hash, RP_RESIDENT_SOME);
     low_flash_available();
     return 0;
 }
 
+/*
+ * Orders the credentials most recent first. The creation times are copied
+ * into small (creation, position) pairs, those are insertion sorted and the
+ * resulting permutation is applied to the Credential array in a single pass,
+ * so every struct moves at most once.
+ */
+void credential_sort_recent_first(Credential *creds, size_t creds_len) {
+    struct {
+        uint64_t creation;
+        uint8_t pos;
+    } keys[MAX_CREDENTIAL_COUNT_IN_LIST];
+    uint8_t order[MAX_CREDENTIAL_COUNT_IN_LIST];
+    size_t n = MIN(creds_len, MAX_CREDENTIAL_COUNT_IN_LIST);
+    for (size_t i = 0; i < n; i++) {
+        size_t j = i;
+        for (; j > 0 && keys[j - 1].creation < creds[i].creation; j--) {
+            keys[j] = keys[j - 1];
+        }
+        keys[j].creation = creds[i].creation;
+        keys[j].pos = (uint8_t)i;
+    }
+    for (size_t i = 0; i < n; i++) {
+        order[i] = keys[i].pos;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (order[i] == i) {
+            continue;
+        }
+        Credential tmp = creds[i];
+        size_t j = i;
+        while (order[j] != i) {
+            size_t src = order[j];
+            creds[j] = creds[src];
+            order[j] = (uint8_t)j;
+            j = src;
+        }
+        creds[j] = tmp;
+        order[j] = (uint8_t)j;
+    }
+}
+
 int credential_derive_hmac_key(const uint8_t *cred_id, size_t cred_id_len, uint8_t *outk) {
     memset(outk, 0, 64);
     int r = 0;
@@ -344,7 +749,7 @@ int credential_derive_hmac_key(const uint8_t *cred_id, size_t cred_id_len, uint8
     const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA512);
 
     mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) "SLIP-0022", 9, outk);
-    mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) CRED_PROTO, 4, outk);
+    mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) CRED_PROTO_CBOR, 4, outk);
     mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) "hmac-secret", 11, outk);
     mbedtls_md_hmac(md_info, outk, 32, cred_id, cred_id_len, outk);
     return 0;
@@ -358,9 +763,9 @@ int credential_derive_chacha_key(uint8_t *outk) {
     }
     const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
 
-    mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) "SLIP-0022", 9, outk);
-    mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) CRED_PROTO, 4, outk);
-    mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) "Encryption key", 14, outk);
+    hash_md_hmac(md_info, outk, 32, (uint8_t *) "SLIP-0022", 9, outk);
+    hash_md_hmac(md_info, outk, 32, (uint8_t *) CRED_PROTO_CBOR, 4, outk);
+    hash_md_hmac(md_info, outk, 32, (uint8_t *) "Encryption key", 14, outk);
     return 0;
 }
 
@@ -372,9 +777,9 @@ int credential_derive_large_blob_key(const uint8_t *cred_id, size_t cred_id_len,
     }
     const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
 
-    mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) "SLIP-0022", 9, outk);
-    mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) CRED_PROTO, 4, outk);
-    mbedtls_md_hmac(md_info, outk, 32, (uint8_t *) "largeBlobKey", 12, outk);
-    mbedtls_md_hmac(md_info, outk, 32, cred_id, cred_id_len, outk);
+    hash_md_hmac(md_info, outk, 32, (uint8_t *) "SLIP-0022", 9, outk);
+    hash_md_hmac(md_info, outk, 32, (uint8_t *) CRED_PROTO_CBOR, 4, outk);
+    hash_md_hmac(md_info, outk, 32, (uint8_t *) "largeBlobKey", 12, outk);
+    hash_md_hmac(md_info, outk, 32, cred_id, cred_id_len, outk);
     return 0;
 }
@@ -56,9 +56,11 @@ typedef struct Credential {
 #define CRED_PROT_UV_OPTIONAL_WITH_LIST     0x02
 #define CRED_PROT_UV_REQUIRED               0x03
 
-#define CRED_PROTO                          "\xf1\xd0\x02\x01"
+#define CRED_PROTO_CBOR                     "\xf1\xd0\x02\x01"
+#define CRED_PROTO                          "\xf1\xd0\x02\x02"
 
 extern int credential_verify(uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash);
+extern int credential_verify_tag(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash, const uint8_t *key);
 extern int credential_create(CborCharString *rpId,
                              CborByteString *userId,
                              CborCharString *userName,
@@ -72,10 +74,21 @@ extern int credential_create(CborCharString *rpId,
                              size_t *cred_id_len);
 extern void credential_free(Credential *cred);
 extern int credential_store(const uint8_t *cred_id, size_t cred_id_len, const uint8_t *rp_id_hash);
+extern void credential_index_reset(void);
+extern void credential_index_put(uint16_t slot, const Credential *cred);
+extern int credential_index_find(const uint8_t *cred_id, size_t cred_id_len);
+extern int credential_index_rp_slot(uint16_t slot);
+extern void credential_sort_recent_first(Credential *creds, size_t creds_len);
 extern int credential_load(const uint8_t *cred_id,
                            size_t cred_id_len,
                            const uint8_t *rp_id_hash,
                            Credential *cred);
+extern int credential_load_key(const uint8_t *cred_id,
+                               size_t cred_id_len,
+                               const uint8_t *rp_id_hash,
+                               const uint8_t *key,
+                               Credential *cred);
+extern int credential_derive_chacha_key(uint8_t *outk);
 extern int credential_derive_hmac_key(const uint8_t *cred_id, size_t cred_id_len, uint8_t *outk);
 extern int credential_derive_large_blob_key(const uint8_t *cred_id,
                                             size_t cred_id_len,
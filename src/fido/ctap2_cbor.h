@@ -26,6 +26,8 @@
 #endif
 #include "mbedtls/ecp.h"
 #include "mbedtls/ecdh.h"
+#include "mbedtls/md.h"
+#include "hash.h"
 
 extern uint8_t *driver_prepare_response();
 extern void driver_exec_finished(size_t size_next);
@@ -163,8 +165,12 @@ typedef struct CborCharString {
     size_t _fdl##_n = sizeof(_fd##_n); \
     CBOR_CHECK(cbor_value_copy_text_string(&(_f##_n), _fd##_n, &_fdl##_n, &(_f##_n)))
 
+// _t must be a string literal: its length is known at compile time and rules out most keys before any byte is compared
+#define CBOR_FIELD_KEY_TEXT_IS(_n, _t) \
+    (_fdl##_n == sizeof(_t) - 1 && memcmp(_fd##_n, _t, sizeof(_t) - 1) == 0)
+
 #define CBOR_FIELD_KEY_TEXT_VAL_TEXT(_n, _t, _v) \
-    if (strcmp(_fd##_n, _t) == 0) { \
+    if (CBOR_FIELD_KEY_TEXT_IS(_n, _t)) { \
         CBOR_ASSERT(cbor_value_is_text_string(&_f##_n) == true); \
         CBOR_CHECK(cbor_value_dup_text_string(&(_f##_n), &(_v).data, &(_v).len, &(_f##_n))); \
         (_v).present = true; \
@@ -172,7 +178,7 @@ typedef struct CborCharString {
     }
 
 #define CBOR_FIELD_KEY_TEXT_VAL_BYTES(_n, _t, _v) \
-    if (strcmp(_fd##_n, _t) == 0) { \
+    if (CBOR_FIELD_KEY_TEXT_IS(_n, _t)) { \
         CBOR_ASSERT(cbor_value_is_byte_string(&_f##_n) == true); \
         CBOR_CHECK(cbor_value_dup_byte_string(&(_f##_n), &(_v).data, &(_v).len, &(_f##_n))); \
         (_v).present = true; \
@@ -180,19 +186,19 @@ typedef struct CborCharString {
     }
 
 #define CBOR_FIELD_KEY_TEXT_VAL_INT(_n, _t, _v) \
-    if (strcmp(_fd##_n, _t) == 0) { \
+    if (CBOR_FIELD_KEY_TEXT_IS(_n, _t)) { \
         CBOR_FIELD_GET_INT(_v, _n); \
         continue; \
     }
 
 #define CBOR_FIELD_KEY_TEXT_VAL_UINT(_n, _t, _v) \
-    if (strcmp(_fd##_n, _t) == 0) { \
+    if (CBOR_FIELD_KEY_TEXT_IS(_n, _t)) { \
         CBOR_FIELD_GET_UINT(_v, _n); \
         continue; \
     }
 
 #define CBOR_FIELD_KEY_TEXT_VAL_BOOL(_n, _t, _v) \
-    if (strcmp(_fd##_n, _t) == 0) { \
+    if (CBOR_FIELD_KEY_TEXT_IS(_n, _t)) { \
         CBOR_FIELD_GET_BOOL(_v, _n); \
         continue; \
     }
@@ -256,4 +262,18 @@ extern CborError COSE_read_key(CborValue *f,
                                CborByteString *kax,
                                CborByteString *kay);
 
+typedef struct auth_data {
+    uint8_t *data;
+    size_t len;
+    size_t max;
+    hash_md_context md;
+} auth_data_t;
+
+extern int auth_data_begin(auth_data_t *ad, const CborEncoder *encoder, uint8_t *buf, size_t buf_len, const mbedtls_md_info_t *md, const uint8_t *rp_id_hash, uint8_t flags, uint32_t ctr);
+extern int auth_data_put(auth_data_t *ad, const uint8_t *data, size_t len);
+extern void auth_data_encoder(auth_data_t *ad, CborEncoder *encoder);
+extern int auth_data_encoded(auth_data_t *ad, const CborEncoder *encoder);
+extern int auth_data_end(auth_data_t *ad, CborEncoder *encoder, const uint8_t *client_data_hash, size_t client_data_hash_len, uint8_t *hash);
+extern void auth_data_free(auth_data_t *ad);
+
 #endif //_CTAP2_CBOR_H_
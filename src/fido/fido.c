@@ -24,6 +24,7 @@
 #include "random.h"
 #include "mbedtls/x509_crt.h"
 #include "mbedtls/hkdf.h"
+#include "hash.h"
 #if defined(USB_ITF_CCID) || defined(ENABLE_EMULATION)
 #include "ccid/ccid.h"
 #endif
@@ -37,6 +38,7 @@
 #include "crypto_utils.h"
 #include "otp.h"
 #include "cbor_local.h"
+#include "credential.h"
 
 // ===== Global Variables =====
 uint8_t PICO_PRODUCT = 2;
@@ -232,7 +234,7 @@ int verify_key(const uint8_t *appId, const uint8_t *keyHandle, mbedtls_ecdsa_con
     uint8_t key_base[CTAP_APPID_SIZE + KEY_PATH_LEN];
     memcpy(key_base, appId, CTAP_APPID_SIZE);
     memcpy(key_base + CTAP_APPID_SIZE, keyHandle, KEY_PATH_LEN);
-    ret = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), d, 32, key_base, sizeof(key_base), hmac);
+    ret = hash_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), d, 32, key_base, sizeof(key_base), hmac);
     mbedtls_platform_zeroize(d, sizeof(d));
     return memcmp(keyHandle + KEY_PATH_LEN, hmac, sizeof(hmac));
 }
@@ -247,6 +249,10 @@ int derive_key(const uint8_t *app_id, bool new_key, uint8_t *key_handle, int cur
     }
     const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA512);
     for (int i = 0; i < KEY_PATH_ENTRIES; i++) {
+        if (fido_yield() == true) {
+            mbedtls_platform_zeroize(outk, sizeof(outk));
+            return CTAP2_ERR_KEEPALIVE_CANCEL;
+        }
         if (new_key == true) {
             uint32_t val = 0;
             random_gen(NULL, (uint8_t *) &val, sizeof(val));
@@ -263,7 +269,7 @@ int derive_key(const uint8_t *app_id, bool new_key, uint8_t *key_handle, int cur
         uint8_t key_base[CTAP_APPID_SIZE + KEY_PATH_LEN];
         memcpy(key_base, app_id, CTAP_APPID_SIZE);
         memcpy(key_base + CTAP_APPID_SIZE, key_handle, KEY_PATH_LEN);
-        if ((r = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), outk, 32, key_base, sizeof(key_base), key_handle + 32)) != 0) {
+        if ((r = hash_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), outk, 32, key_base, sizeof(key_base), key_handle + 32)) != 0) {
             mbedtls_platform_zeroize(outk, sizeof(outk));
             return r;
         }
@@ -272,6 +278,7 @@ int derive_key(const uint8_t *app_id, bool new_key, uint8_t *key_handle, int cur
         mbedtls_ecp_group_load(&key->grp, curve);
         const mbedtls_ecp_curve_info *cinfo = mbedtls_ecp_curve_info_from_grp_id(curve);
         if (cinfo == NULL) {
+            mbedtls_platform_zeroize(outk, sizeof(outk));
             return 1;
         }
         if (cinfo->bit_size % 8 != 0) {
@@ -282,6 +289,10 @@ int derive_key(const uint8_t *app_id, bool new_key, uint8_t *key_handle, int cur
         if (r != 0) {
             return r;
         }
+        if (fido_yield() == true) {
+            mbedtls_mpi_free(&key->d);
+            return CTAP2_ERR_KEEPALIVE_CANCEL;
+        }
         return mbedtls_ecp_mul(&key->grp, &key->Q, &key->d, &key->grp.G, random_gen, NULL);
     }
     mbedtls_platform_zeroize(outk, sizeof(outk));
@@ -290,6 +301,11 @@ int derive_key(const uint8_t *app_id, bool new_key, uint8_t *key_handle, int cur
 
 // ===== File Management =====
 int scan_files() {
+    cbor_get_info_invalidate();
+    cap_refresh();
+    fido_conf_load();
+    scan_slots();
+    credential_index_reset();
     ef_keydev = search_by_fid(EF_KEY_DEV, NULL, SPECIFY_EF);
     ef_keydev_enc = search_by_fid(EF_KEY_DEV_ENC, NULL, SPECIFY_EF);
     if (ef_keydev) {
@@ -389,10 +405,25 @@ void scan_all() {
 }
 
 void init_fido() {
+    hash_init();
+    rp_cache_flush();
     scan_all();
     init_otp();
 }
 
+// ===== Long Operations =====
+/*
+ * Cancellation point for long operations. While the card thread is busy the
+ * USB side keeps answering the host with CTAPHID_KEEPALIVE (STATUS_PROCESSING)
+ * and turns a CTAPHID_CANCEL into cancel_button. Loops that decrypt one
+ * credential per step, as well as key derivation, call fido_yield() between
+ * steps and bail out with CTAP2_ERR_KEEPALIVE_CANCEL when it returns true, so
+ * a cancelled request frees the channel instead of running to completion.
+ */
+bool fido_yield() {
+    return cancel_button;
+}
+
 // ===== User Interface =====
 bool wait_button_pressed() {
     uint32_t val = EV_PRESS_BUTTON;
@@ -425,20 +456,85 @@ uint32_t get_sign_counter() {
     return (*caddr) | (*(caddr + 1) << 8) | (*(caddr + 2) << 16) | (*(caddr + 3) << 24);
 }
 
-uint8_t get_opts() {
+fido_conf_t fido_conf = { .min_pin_len = 4 };
+
+void fido_conf_load() {
+    memset(&fido_conf, 0, sizeof(fido_conf));
     file_t *ef = search_by_fid(EF_OPTS, NULL, SPECIFY_EF);
     if (file_has_data(ef)) {
-        return *file_get_data(ef);
+        fido_conf.opts = *file_get_data(ef);
     }
-    return 0;
+    fido_conf.min_pin_len = 4;
+    ef = search_by_fid(EF_MINPINLEN, NULL, SPECIFY_EF);
+    if (file_has_data(ef)) {
+        const uint8_t *data = file_get_data(ef);
+        uint16_t size = file_get_size(ef);
+        fido_conf.min_pin_len = data[0];
+        fido_conf.force_pin_change = size > 1 && data[1] == 1;
+        if (size > 2) {
+            fido_conf.min_pin_rps = (uint8_t) MIN((size - 2) / 32, MAX_MIN_PIN_RPS);
+            memcpy(fido_conf.min_pin_rp_hash, data + 2, fido_conf.min_pin_rps * 32);
+        }
+    }
+}
+
+uint8_t get_opts() {
+    return fido_conf.opts;
 }
 
 void set_opts(uint8_t opts) {
     file_t *ef = search_by_fid(EF_OPTS, NULL, SPECIFY_EF);
     file_put_data(ef, &opts, sizeof(uint8_t));
+    fido_conf.opts = opts;
+    cbor_get_info_invalidate();
     low_flash_available();
 }
 
+int fido_conf_set_min_pin(uint8_t min_pin_len, bool force_pin_change, const uint8_t *rp_hashes, uint8_t rp_count) {
+    if (rp_count > MAX_MIN_PIN_RPS) {
+        return PICOKEY_ERR_INVALID_PARAMETER;
+    }
+    file_t *ef = search_by_fid(EF_MINPINLEN, NULL, SPECIFY_EF);
+    if (!ef) {
+        return PICOKEY_ERR_FILE_NOT_FOUND;
+    }
+    uint16_t len = (uint16_t) (2 + rp_count * 32);
+    uint8_t *dataf = (uint8_t *) calloc(1, len);
+    if (!dataf) {
+        return PICOKEY_ERR_NO_MEMORY;
+    }
+    dataf[0] = min_pin_len;
+    dataf[1] = force_pin_change ? 1 : 0;
+    if (rp_count > 0) {
+        memcpy(dataf + 2, rp_hashes, rp_count * 32);
+    }
+    int ret = file_put_data(ef, dataf, len);
+    free(dataf);
+    if (ret != PICOKEY_OK) {
+        return ret;
+    }
+    fido_conf_load();
+    cbor_get_info_invalidate();
+    low_flash_available();
+    return PICOKEY_OK;
+}
+
+int fido_conf_clear_force_pin_change() {
+    if (!fido_conf.force_pin_change) {
+        return PICOKEY_OK;
+    }
+    return fido_conf_set_min_pin(fido_conf.min_pin_len, false, fido_conf.min_pin_rp_hash[0], fido_conf.min_pin_rps);
+}
+
+bool fido_conf_min_pin_rp(const uint8_t *rp_id_hash) {
+    for (uint8_t i = 0; i < fido_conf.min_pin_rps; i++) {
+        if (memcmp(fido_conf.min_pin_rp_hash[i], rp_id_hash, 32) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // ===== CBOR Command Processing =====
 
 int cmd_cbor() {
@@ -466,6 +562,8 @@ int fido_process_apdu() {
     if (CLA(apdu) != 0x00 && CLA(apdu) != 0x80) {
         return SW_CLA_NOT_SUPPORTED();
     }
+    // A cancel only applies to the request it interrupted
+    cancel_button = false;
     if (cap_supported(CAP_U2F)) {
         for (const cmd_t *cmd = cmds; cmd->ins != 0x00; cmd++) {
             if (cmd->ins == INS(apdu)) {
@@ -89,6 +89,36 @@ typedef struct known_app {
     const bool *use_self_attestation;
 } known_app_t;
 
+#define RP_CACHE_SIZE               4
+#define RP_CACHE_ID_LEN             64
+
+#define RP_RESIDENT_UNKNOWN         0
+#define RP_RESIDENT_NONE            1
+#define RP_RESIDENT_SOME            2
+
+typedef struct rp_info {
+    uint8_t rp_id[RP_CACHE_ID_LEN];
+    uint8_t rp_id_len;
+    uint8_t resident;
+    uint8_t rp_id_hash[32];
+    const known_app_t *ka;
+} rp_info_t;
+
+#define MAX_MIN_PIN_RPS             32
+
+/* RAM copy of EF_OPTS and EF_MINPINLEN. Loaded by scan_files() and written
+ * through by the setters below, so request handlers never walk the file table
+ * to read the device configuration. */
+typedef struct fido_conf {
+    uint8_t opts;
+    uint8_t min_pin_len;
+    bool force_pin_change;
+    uint8_t min_pin_rps;
+    uint8_t min_pin_rp_hash[MAX_MIN_PIN_RPS][32];
+} fido_conf_t;
+
+extern fido_conf_t fido_conf;
+
 typedef struct pinUvAuthToken {
     uint8_t *data;
     size_t len;
@@ -145,9 +175,17 @@ void clearPinUvAuthTokenPermissionsExceptLbw(void);
 uint32_t get_sign_counter(void);
 uint8_t get_opts(void);
 void set_opts(uint8_t);
-void send_keepalive(void);
+void fido_conf_load(void);
+int fido_conf_set_min_pin(uint8_t min_pin_len, bool force_pin_change, const uint8_t *rp_hashes, uint8_t rp_count);
+int fido_conf_clear_force_pin_change(void);
+bool fido_conf_min_pin_rp(const uint8_t *rp_id_hash);
+void cbor_get_info_invalidate(void);
+bool fido_yield(void);
 
 // Utility Functions
 const known_app_t *find_app_by_rp_id_hash(const uint8_t *rp_id_hash);
+const rp_info_t *rp_info_get(const char *rp_id, size_t len);
+void rp_info_set_resident(const uint8_t *rp_id_hash, uint8_t resident);
+void rp_cache_flush(void);
 
 #endif // _FIDO_H_
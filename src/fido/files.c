@@ -15,7 +15,10 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "pico_keys.h"
 #include "files.h"
+#include "fido.h"
+#include "oath.h"
 
 file_t file_entries[] = {
     { .fid = 0x3f00, .parent = 0xff, .name = NULL, .type = FILE_TYPE_DF, .data = NULL,
@@ -62,3 +65,116 @@ file_t *ef_pin = NULL;
 file_t *ef_authtoken = NULL;
 file_t *ef_keydev_enc = NULL;
 file_t *ef_largeblob = NULL;
+
+/*
+ * Resident credentials, RPs and OATH pages are dynamic files that are walked
+ * in hot loops. Their file_t pointers are kept here indexed by slot, so a scan
+ * is a plain array walk instead of a search_dynamic_file() per slot.
+ *
+ * delete_file() compacts the dynamic file table and moves every entry behind
+ * the deleted one, so dynamic files must be removed with slot_delete_file(),
+ * which clears the slot of the deleted file and moves down the pointers that
+ * were behind it.
+ */
+file_t *cred_slots[MAX_RESIDENT_CREDENTIALS];
+file_t *rp_slots[MAX_RESIDENT_CREDENTIALS];
+file_t *oath_slots[OATH_PAGES];
+
+/*
+ * One bit per EF_CRED / EF_RP slot, set when the slot file is created with
+ * slot_file_new() or found with data by scan_slots(). Free slots
+ * are found with a count-trailing-zeros on the inverted words and occupancy
+ * is a popcount, so neither needs to touch the files.
+ */
+uint32_t cred_used[SLOT_MAP_WORDS(MAX_RESIDENT_CREDENTIALS)];
+uint32_t rp_used[SLOT_MAP_WORDS(MAX_RESIDENT_CREDENTIALS)];
+
+static void slot_map_put(uint32_t *map, uint16_t slot, bool used) {
+    if (used) {
+        map[slot / 32] |= 1u << (slot % 32);
+    }
+    else {
+        map[slot / 32] &= ~(1u << (slot % 32));
+    }
+}
+
+int slot_map_first_free(const uint32_t *map, uint16_t slots) {
+    for (uint16_t w = 0; w < SLOT_MAP_WORDS(slots); w++) {
+        uint32_t free_bits = ~map[w];
+        if (free_bits != 0) {
+            uint16_t slot = (uint16_t)(w * 32 + __builtin_ctz(free_bits));
+            return slot < slots ? slot : -1;
+        }
+    }
+    return -1;
+}
+
+uint16_t slot_map_count(const uint32_t *map, uint16_t slots) {
+    uint16_t count = 0;
+    for (uint16_t w = 0; w < SLOT_MAP_WORDS(slots); w++) {
+        count += (uint16_t)__builtin_popcount(map[w]);
+    }
+    return count;
+}
+
+void scan_slots() {
+    for (uint16_t i = 0; i < MAX_RESIDENT_CREDENTIALS; i++) {
+        cred_slots[i] = search_dynamic_file((uint16_t)(EF_CRED + i));
+        rp_slots[i] = search_dynamic_file((uint16_t)(EF_RP + i));
+        slot_map_put(cred_used, i, file_has_data(cred_slots[i]));
+        slot_map_put(rp_used, i, file_has_data(rp_slots[i]));
+    }
+    for (uint8_t i = 0; i < OATH_PAGES; i++) {
+        oath_slots[i] = search_dynamic_file((uint16_t)(EF_OATH_PAGE + i));
+    }
+}
+
+file_t *slot_file_new(uint16_t fid) {
+    file_t *ef = file_new(fid);
+    if (fid >= EF_CRED && fid < EF_CRED + MAX_RESIDENT_CREDENTIALS) {
+        cred_slots[fid - EF_CRED] = ef;
+        slot_map_put(cred_used, fid - EF_CRED, ef != NULL);
+    }
+    else if (fid >= EF_RP && fid < EF_RP + MAX_RESIDENT_CREDENTIALS) {
+        rp_slots[fid - EF_RP] = ef;
+        slot_map_put(rp_used, fid - EF_RP, ef != NULL);
+    }
+    else if (fid >= EF_OATH_PAGE && fid < EF_OATH_PAGE + OATH_PAGES) {
+        oath_slots[fid - EF_OATH_PAGE] = ef;
+    }
+    return ef;
+}
+
+static void slot_forget(file_t **slots, uint16_t n, const file_t *ef, bool dynamic) {
+    for (uint16_t i = 0; i < n; i++) {
+        if (slots[i] == ef) {
+            slots[i] = NULL;
+        }
+        else if (dynamic && slots[i] > ef) {
+            // delete_file() ends in delete_dynamic_file() of the SDK (fs/file.c),
+            // which copies every dynamic_file[] entry behind the deleted one down
+            // by one and decrements dynamic_files, so the pointers follow
+            slots[i]--;
+        }
+    }
+}
+
+int slot_delete_file(file_t *ef) {
+    if (!ef) {
+        return PICOKEY_ERR_FILE_NOT_FOUND;
+    }
+    uint16_t fid = ef->fid;
+    // Only entries of the dynamic table move
+    bool dynamic = search_dynamic_file(fid) == ef;
+    int ret = delete_file(ef);
+    if (fid >= EF_CRED && fid < EF_CRED + MAX_RESIDENT_CREDENTIALS) {
+        slot_map_put(cred_used, fid - EF_CRED, false);
+    }
+    else if (fid >= EF_RP && fid < EF_RP + MAX_RESIDENT_CREDENTIALS) {
+        slot_map_put(rp_used, fid - EF_RP, false);
+    }
+    slot_forget(cred_slots, MAX_RESIDENT_CREDENTIALS, ef, dynamic);
+    slot_forget(rp_slots, MAX_RESIDENT_CREDENTIALS, ef, dynamic);
+    slot_forget(oath_slots, OATH_PAGES, ef, dynamic);
+    return ret;
+}
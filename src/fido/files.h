@@ -33,8 +33,10 @@
 #define EF_CRED         0xCF00 // Creds at 0xCF00 - 0xCFFF
 #define EF_RP           0xD000 // RPs at 0xD000 - 0xD0FF
 #define EF_LARGEBLOB    0x1101 // Large Blob Array
-#define EF_OATH_CRED    0xBA00 // OATH Creds at 0xBA00 - 0xBAFE
+#define EF_OATH_CRED    0xBA00 // Legacy OATH Creds at 0xBA00 - 0xBAFE
 #define EF_OATH_CODE    0xBAFF
+#define EF_OATH_PAGE    0xBC00 // Packed OATH store at 0xBC00 - 0xBC1F
+#define EF_OATH_IMF     0xBD00 // OATH HOTP counters at 0xBD00 - 0xBDFF
 #define EF_OTP_SLOT1    0xBB00
 #define EF_OTP_SLOT2    0xBB01
 #define EF_OTP_PIN      0x10A0 // Nitrokey OTP PIN
@@ -47,4 +49,20 @@ extern file_t *ef_authtoken;
 extern file_t *ef_keydev_enc;
 extern file_t *ef_largeblob;
 
+extern file_t *cred_slots[];
+extern file_t *rp_slots[];
+extern file_t *oath_slots[];
+
+#define SLOT_MAP_WORDS(n)   (((n) + 31) / 32)
+#define slot_map_used(map, slot) (((map)[(slot) / 32] >> ((slot) % 32)) & 1)
+
+extern uint32_t cred_used[];
+extern uint32_t rp_used[];
+
+void scan_slots(void);
+file_t *slot_file_new(uint16_t fid);
+int slot_delete_file(file_t *ef);
+int slot_map_first_free(const uint32_t *map, uint16_t slots);
+uint16_t slot_map_count(const uint32_t *map, uint16_t slots);
+
 #endif //_FILES_H_
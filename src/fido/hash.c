@@ -0,0 +1,332 @@
+/*
+ * This file is part of the Pico FIDO distribution (https://github.com/polhenarejos/pico-fido).
+ * Copyright (c) 2022 Pol Henarejos.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pico_keys.h"
+#include "hash.h"
+#include "mbedtls/hkdf.h"
+#include "mbedtls/platform_util.h"
+
+#define HMAC_BLOCK_SIZE     64
+
+#ifdef HASH_SHA256_HW
+// Cleared by hash_init() if the accelerator fails its known-answer check
+static bool hw_enabled = true;
+#endif
+
+int hash_sha256_starts(hash_sha256_context *ctx) {
+#ifdef HASH_SHA256_HW
+    ctx->use_hw = hw_enabled && pico_sha256_try_start(&ctx->hw, SHA256_BIG_ENDIAN, false) == PICO_OK;
+    if (ctx->use_hw) {
+        return 0;
+    }
+#endif
+    mbedtls_sha256_init(&ctx->sw);
+    return mbedtls_sha256_starts(&ctx->sw, 0);
+}
+
+int hash_sha256_update(hash_sha256_context *ctx, const uint8_t *input, size_t ilen) {
+#ifdef HASH_SHA256_HW
+    if (ctx->use_hw) {
+        pico_sha256_update_blocking(&ctx->hw, input, ilen);
+        return 0;
+    }
+#endif
+    return mbedtls_sha256_update(&ctx->sw, input, ilen);
+}
+
+int hash_sha256_finish(hash_sha256_context *ctx, uint8_t *output) {
+#ifdef HASH_SHA256_HW
+    if (ctx->use_hw) {
+        sha256_result_t res;
+        pico_sha256_finish(&ctx->hw, &res);
+        ctx->use_hw = false;
+        memcpy(output, res.bytes, 32);
+        mbedtls_platform_zeroize(&res, sizeof(res));
+        return 0;
+    }
+#endif
+    int ret = mbedtls_sha256_finish(&ctx->sw, output);
+    mbedtls_sha256_free(&ctx->sw);
+    return ret;
+}
+
+// Releases the context after an aborted hash. It is a no-op after finish.
+void hash_sha256_free(hash_sha256_context *ctx) {
+#ifdef HASH_SHA256_HW
+    if (ctx->use_hw) {
+        pico_sha256_cleanup(&ctx->hw);
+        ctx->use_hw = false;
+        return;
+    }
+#endif
+    mbedtls_sha256_free(&ctx->sw);
+}
+
+int hash_sha256(const uint8_t *input, size_t ilen, uint8_t *output) {
+    hash_sha256_context ctx;
+    int ret = hash_sha256_starts(&ctx);
+    if (ret == 0) {
+        ret = hash_sha256_update(&ctx, input, ilen);
+    }
+    if (ret == 0) {
+        return hash_sha256_finish(&ctx, output);
+    }
+    hash_sha256_free(&ctx);
+    return ret;
+}
+
+static bool hash_is_sha256(const mbedtls_md_info_t *md_info) {
+    return md_info != NULL && mbedtls_md_get_type(md_info) == MBEDTLS_MD_SHA256;
+}
+
+int hash_md_starts(hash_md_context *ctx, const mbedtls_md_info_t *md_info) {
+    ctx->md_info = md_info;
+    if (hash_is_sha256(md_info)) {
+        return hash_sha256_starts(&ctx->sha256);
+    }
+    mbedtls_md_init(&ctx->md);
+    int ret = mbedtls_md_setup(&ctx->md, md_info, 0);
+    if (ret == 0) {
+        ret = mbedtls_md_starts(&ctx->md);
+    }
+    return ret;
+}
+
+int hash_md_update(hash_md_context *ctx, const uint8_t *input, size_t ilen) {
+    if (hash_is_sha256(ctx->md_info)) {
+        return hash_sha256_update(&ctx->sha256, input, ilen);
+    }
+    return mbedtls_md_update(&ctx->md, input, ilen);
+}
+
+int hash_md_finish(hash_md_context *ctx, uint8_t *output) {
+    if (hash_is_sha256(ctx->md_info)) {
+        ctx->md_info = NULL;
+        return hash_sha256_finish(&ctx->sha256, output);
+    }
+    return mbedtls_md_finish(&ctx->md, output);
+}
+
+void hash_md_free(hash_md_context *ctx) {
+    if (hash_is_sha256(ctx->md_info)) {
+        hash_sha256_free(&ctx->sha256);
+    }
+    else if (ctx->md_info != NULL) {
+        mbedtls_md_free(&ctx->md);
+    }
+    ctx->md_info = NULL;
+}
+
+int hash_md(const mbedtls_md_info_t *md_info, const uint8_t *input, size_t ilen, uint8_t *output) {
+    if (hash_is_sha256(md_info)) {
+        return hash_sha256(input, ilen, output);
+    }
+    return mbedtls_md(md_info, input, ilen, output);
+}
+
+/*
+ * HMAC-SHA256 (RFC 2104) on top of the backend. The key is copied into the
+ * pad block first and the output is written last, so key, input and output
+ * may overlap as they do with mbedtls_md_hmac().
+ */
+static int hmac_sha256_starts(hash_sha256_context *ctx, const uint8_t *key, size_t keylen, uint8_t *opad) {
+    uint8_t ipad[HMAC_BLOCK_SIZE];
+    int ret = 0;
+    memset(opad, 0, HMAC_BLOCK_SIZE);
+    if (keylen > HMAC_BLOCK_SIZE) {
+        if ((ret = hash_sha256(key, keylen, opad)) != 0) {
+            return ret;
+        }
+    }
+    else {
+        memcpy(opad, key, keylen);
+    }
+    for (int i = 0; i < HMAC_BLOCK_SIZE; i++) {
+        ipad[i] = opad[i] ^ 0x36;
+        opad[i] ^= 0x5C;
+    }
+    ret = hash_sha256_starts(ctx);
+    if (ret == 0) {
+        ret = hash_sha256_update(ctx, ipad, sizeof(ipad));
+        if (ret != 0) {
+            hash_sha256_free(ctx);
+        }
+    }
+    mbedtls_platform_zeroize(ipad, sizeof(ipad));
+    return ret;
+}
+
+static int hmac_sha256_finish(hash_sha256_context *ctx, const uint8_t *opad, uint8_t *output) {
+    uint8_t inner[32];
+    int ret = hash_sha256_finish(ctx, inner);
+    if (ret == 0) {
+        ret = hash_sha256_starts(ctx);
+    }
+    if (ret == 0) {
+        ret = hash_sha256_update(ctx, opad, HMAC_BLOCK_SIZE);
+        if (ret == 0) {
+            ret = hash_sha256_update(ctx, inner, sizeof(inner));
+        }
+        if (ret == 0) {
+            ret = hash_sha256_finish(ctx, output);
+        }
+        else {
+            hash_sha256_free(ctx);
+        }
+    }
+    mbedtls_platform_zeroize(inner, sizeof(inner));
+    return ret;
+}
+
+int hash_md_hmac(const mbedtls_md_info_t *md_info,
+                 const uint8_t *key,
+                 size_t keylen,
+                 const uint8_t *input,
+                 size_t ilen,
+                 uint8_t *output) {
+    if (!hash_is_sha256(md_info)) {
+        return mbedtls_md_hmac(md_info, key, keylen, input, ilen, output);
+    }
+    hash_sha256_context ctx;
+    uint8_t opad[HMAC_BLOCK_SIZE];
+    int ret = hmac_sha256_starts(&ctx, key, keylen, opad);
+    if (ret == 0) {
+        ret = hash_sha256_update(&ctx, input, ilen);
+        if (ret == 0) {
+            ret = hmac_sha256_finish(&ctx, opad, output);
+        }
+        else {
+            hash_sha256_free(&ctx);
+        }
+    }
+    mbedtls_platform_zeroize(opad, sizeof(opad));
+    return ret;
+}
+
+// HKDF (RFC 5869)
+int hash_hkdf(const mbedtls_md_info_t *md_info,
+              const uint8_t *salt,
+              size_t salt_len,
+              const uint8_t *ikm,
+              size_t ikm_len,
+              const uint8_t *info,
+              size_t info_len,
+              uint8_t *okm,
+              size_t okm_len) {
+    if (!hash_is_sha256(md_info)) {
+        return mbedtls_hkdf(md_info, salt, salt_len, ikm, ikm_len, info, info_len, okm, okm_len);
+    }
+    if (okm_len > 255 * 32) {
+        return PICOKEY_ERR_INVALID_PARAMETER;
+    }
+    uint8_t prk[32], t[32], zeros[32] = { 0 }, opad[HMAC_BLOCK_SIZE];
+    if (salt == NULL || salt_len == 0) {
+        salt = zeros;
+        salt_len = sizeof(zeros);
+    }
+    int ret = hash_md_hmac(md_info, salt, salt_len, ikm, ikm_len, prk);
+    hash_sha256_context ctx;
+    for (uint8_t i = 1; ret == 0 && okm_len > 0; i++) {
+        ret = hmac_sha256_starts(&ctx, prk, sizeof(prk), opad);
+        if (ret != 0) {
+            break;
+        }
+        if (i > 1) {
+            ret = hash_sha256_update(&ctx, t, sizeof(t));
+        }
+        if (ret == 0) {
+            ret = hash_sha256_update(&ctx, info, info_len);
+        }
+        if (ret == 0) {
+            ret = hash_sha256_update(&ctx, &i, 1);
+        }
+        if (ret != 0) {
+            hash_sha256_free(&ctx);
+            break;
+        }
+        if ((ret = hmac_sha256_finish(&ctx, opad, t)) == 0) {
+            size_t n = okm_len < sizeof(t) ? okm_len : sizeof(t);
+            memcpy(okm, t, n);
+            okm += n;
+            okm_len -= n;
+        }
+    }
+    mbedtls_platform_zeroize(prk, sizeof(prk));
+    mbedtls_platform_zeroize(t, sizeof(t));
+    mbedtls_platform_zeroize(opad, sizeof(opad));
+    return ret;
+}
+
+#if defined(HASH_SHA256_HW) && ENABLE_HASH_BENCH
+#include "hardware/clocks.h"
+#include "pico/time.h"
+
+#define HASH_BENCH_ROUNDS   64
+
+/*
+ * Prints the cycles per message of the accelerator and of mbedtls_sha256(), for
+ * one block and for 1 KiB. Only built with ENABLE_HASH_BENCH, to compare the
+ * backends on a board through its serial console.
+ */
+static void hash_bench(void) {
+    static uint8_t msg[1024];
+    uint8_t out[32];
+    const uint32_t mhz = clock_get_hz(clk_sys) / 1000000;
+    const size_t lens[] = { 64, sizeof(msg) };
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        uint32_t t0 = time_us_32();
+        for (int i = 0; i < HASH_BENCH_ROUNDS; i++) {
+            hash_sha256(msg, lens[l], out);
+        }
+        uint32_t hw_us = time_us_32() - t0;
+        t0 = time_us_32();
+        for (int i = 0; i < HASH_BENCH_ROUNDS; i++) {
+            mbedtls_sha256(msg, lens[l], out, 0);
+        }
+        uint32_t sw_us = time_us_32() - t0;
+        printf("SHA-256 %u bytes: %s %lu cycles, mbedtls %lu cycles\n", (unsigned) lens[l],
+               hw_enabled ? "accelerator" : "fallback", (unsigned long) (hw_us * mhz / HASH_BENCH_ROUNDS),
+               (unsigned long) (sw_us * mhz / HASH_BENCH_ROUNDS));
+    }
+}
+#endif
+
+/*
+ * Known-answer check of the accelerator with the one and two block messages of
+ * FIPS 180-2. If a digest is wrong, SHA-256 stays on mbedtls.
+ */
+void hash_init(void) {
+#ifdef HASH_SHA256_HW
+    static const uint8_t kat1[32] = {
+        0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+        0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+    };
+    static const uint8_t kat2[32] = {
+        0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+        0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1
+    };
+    static const char msg2[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    uint8_t out[32];
+    if (hash_sha256((const uint8_t *) "abc", 3, out) != 0 || memcmp(out, kat1, sizeof(out)) != 0 ||
+        hash_sha256((const uint8_t *) msg2, sizeof(msg2) - 1, out) != 0 || memcmp(out, kat2, sizeof(out)) != 0) {
+        hw_enabled = false;
+    }
+#if ENABLE_HASH_BENCH
+    hash_bench();
+#endif
+#endif
+}
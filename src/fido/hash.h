@@ -0,0 +1,82 @@
+/*
+ * This file is part of the Pico FIDO distribution (https://github.com/polhenarejos/pico-fido).
+ * Copyright (c) 2022 Pol Henarejos.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "mbedtls/md.h"
+#include "mbedtls/sha256.h"
+
+#if defined(PICO_RP2350) && !defined(ENABLE_EMULATION) && !defined(ESP_PLATFORM)
+#define HASH_SHA256_HW
+#include "pico/sha256.h"
+#endif
+
+/*
+ * SHA-256 backend. On RP2350 digests are computed by the SHA-256 accelerator,
+ * elsewhere (and whenever the accelerator is held by another context) they
+ * fall back to mbedtls. The hash_md* functions have the signatures of their
+ * mbedtls_md* counterparts and only route SHA-256 to the backend, so callers
+ * that pick the digest at runtime (authData, OATH) can use them unchanged.
+ */
+typedef struct hash_sha256_context {
+#ifdef HASH_SHA256_HW
+    pico_sha256_state_t hw;
+    bool use_hw;
+#endif
+    mbedtls_sha256_context sw;
+} hash_sha256_context;
+
+typedef struct hash_md_context {
+    const mbedtls_md_info_t *md_info;
+    hash_sha256_context sha256;
+    mbedtls_md_context_t md;
+} hash_md_context;
+
+extern int hash_sha256_starts(hash_sha256_context *ctx);
+extern int hash_sha256_update(hash_sha256_context *ctx, const uint8_t *input, size_t ilen);
+extern int hash_sha256_finish(hash_sha256_context *ctx, uint8_t *output);
+extern void hash_sha256_free(hash_sha256_context *ctx);
+extern int hash_sha256(const uint8_t *input, size_t ilen, uint8_t *output);
+
+extern int hash_md_starts(hash_md_context *ctx, const mbedtls_md_info_t *md_info);
+extern int hash_md_update(hash_md_context *ctx, const uint8_t *input, size_t ilen);
+extern int hash_md_finish(hash_md_context *ctx, uint8_t *output);
+extern void hash_md_free(hash_md_context *ctx);
+extern int hash_md(const mbedtls_md_info_t *md_info, const uint8_t *input, size_t ilen, uint8_t *output);
+extern int hash_md_hmac(const mbedtls_md_info_t *md_info,
+                        const uint8_t *key,
+                        size_t keylen,
+                        const uint8_t *input,
+                        size_t ilen,
+                        uint8_t *output);
+extern int hash_hkdf(const mbedtls_md_info_t *md_info,
+                     const uint8_t *salt,
+                     size_t salt_len,
+                     const uint8_t *ikm,
+                     size_t ikm_len,
+                     const uint8_t *info,
+                     size_t info_len,
+                     uint8_t *okm,
+                     size_t okm_len);
+
+extern void hash_init(void);
+
+#endif //_HASH_H_
@@ -123,10 +123,22 @@ int man_process_apdu(void) {
 }
 
 /* Capability checking */
-bool cap_supported(uint16_t cap) {
+/*
+ * cap_supported() is called on almost every request, so the enabled
+ * capabilities are decoded from EF_DEV_CONF once into a bitmask and only
+ * decoded again by cap_refresh() when the configuration is written or the
+ * device is reset. Without EF_DEV_CONF or TAG_USB_ENABLED everything is
+ * enabled.
+ */
+static uint16_t caps_enabled = 0xFFFF;
+static bool caps_loaded = false;
+
+void cap_refresh(void) {
+    caps_enabled = 0xFFFF;
+    caps_loaded = true;
     file_t *ef = search_dynamic_file(EF_DEV_CONF);
     if (!file_has_data(ef)) {
-        return true;
+        return;
     }
 
     uint16_t tag = 0;
@@ -141,10 +153,17 @@ bool cap_supported(uint16_t cap) {
             if (tag_len == 2) {
                 ecaps = (tag_data[0] << 8) | tag_data[1];
             }
-            return ecaps & cap;
+            caps_enabled = ecaps;
+            return;
         }
     }
-    return true;
+}
+
+bool cap_supported(uint16_t cap) {
+    if (caps_loaded == false) {
+        cap_refresh();
+    }
+    return caps_enabled & cap;
 }
 
 /* Configuration management */
@@ -228,6 +247,7 @@ int cmd_write_config(void) {
 
     file_t *ef = file_new(EF_DEV_CONF);
     file_put_data(ef, apdu.data + 1, (uint16_t)(apdu.nc - 1));
+    cap_refresh();
     low_flash_available();
     return SW_OK();
 }
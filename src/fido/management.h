@@ -95,6 +95,11 @@ int man_get_config(void);
  */
 bool cap_supported(uint16_t cap);
 
+/**
+ * @brief Decode the enabled capabilities from EF_DEV_CONF again
+ */
+void cap_refresh(void);
+
 /* Command handlers */
 /**
  * @brief Handle read config command
@@ -25,10 +25,28 @@
 #include "crypto_utils.h"
 #include "management.h"
 #include "oath.h"
+#include "hash.h"
 
 static bool validated = true;
 static uint8_t challenge[CHALLENGE_LEN] = { 0 };
 
+static void oath_migrate_legacy();
+static void oath_more_clear();
+
+#define INS_PUT             0x01
+#define INS_DELETE          0x02
+#define INS_SET_CODE        0x03
+#define INS_RESET           0x04
+#define INS_LIST            0xa1
+#define INS_CALCULATE       0xa2
+#define INS_VALIDATE        0xa3
+#define INS_CALC_ALL        0xa4
+#define INS_SEND_REMAINING  0xa5
+#define INS_VERIFY_CODE     0xb1
+#define INS_VERIFY_PIN      0xb2
+#define INS_CHANGE_PIN      0xb3
+#define INS_SET_PIN         0xb4
+
 const uint8_t oath_aid[] = {
     7,
     0xa0, 0x00, 0x00, 0x05, 0x27, 0x21, 0x01
@@ -48,6 +66,8 @@ int oath_select(app_t *a, uint8_t force) {
         res_APDU[res_APDU_size++] = TAG_NAME;
         res_APDU[res_APDU_size++] = 8;
         memcpy(res_APDU + res_APDU_size, pico_serial_str, 8); res_APDU_size += 8;
+        oath_more_clear();
+        oath_migrate_legacy();
         if (file_has_data(search_dynamic_file(EF_OATH_CODE)) == true) {
             random_gen(NULL, challenge, sizeof(challenge));
             res_APDU[res_APDU_size++] = TAG_CHALLENGE;
@@ -79,66 +99,359 @@ int oath_unload() {
     return PICOKEY_OK;
 }
 
-file_t *find_oath_cred(const uint8_t *name, size_t name_len) {
-    for (int i = 0; i < MAX_OATH_CRED; i++) {
-        file_t *ef = search_dynamic_file((uint16_t)(EF_OATH_CRED + i));
-        asn1_ctx_t ctxi, ef_tag = { 0 };
-        asn1_ctx_init(file_get_data(ef), file_get_size(ef), &ctxi);
-        if (file_has_data(ef) && asn1_find_tag(&ctxi, TAG_NAME, &ef_tag) == true && ef_tag.len == name_len && memcmp(ef_tag.data, name, name_len) == 0) {
-            return ef;
+/*
+ * OATH credentials are packed into a few page files (EF_OATH_PAGE + n). Each
+ * page is a sequence of records: a fixed oath_hdr_t followed by the name, the
+ * key (alg, digits, secret) and, for HOTP, the id of its IMF file.
+ *
+ * The OATH_PAGES pages hold MAX_OATH_CRED records of up to 128 bytes, e.g. a
+ * 64-byte name with a SHA-256 secret. Longer records fill the store earlier,
+ * down to 96 credentials with 255-byte names and keys, and PUT then fails
+ * with SW_FILE_FULL.
+ */
+PACK(
+typedef struct oath_hdr {
+    uint8_t name_len;
+    uint8_t key_len;
+    uint8_t prop;
+    uint8_t flags;
+}) oath_hdr_t;
+
+#define OATH_FLAG_IMF   0x01
+
+/*
+ * The 8-byte IMF of a HOTP credential is kept in its own file (EF_OATH_IMF +
+ * id) rather than in the page, so a calculation rewrites 8 bytes instead of
+ * up to OATH_PAGE_SIZE. Ids are taken from the records that are stored, so a
+ * file left behind by an interrupted PUT is reused. At most OATH_IMF_FILES
+ * HOTP credentials are stored.
+ */
+#define OATH_IMF_FILES  256
+
+typedef struct {
+    file_t *ef;
+    uint16_t page;
+    uint16_t off;
+    uint16_t len;
+    const uint8_t *name;
+    const uint8_t *key;
+    const uint8_t *imf;
+    file_t *imf_ef;
+    uint8_t name_len;
+    uint8_t key_len;
+    uint8_t prop;
+    uint8_t flags;
+    uint8_t imf_id;
+} oath_cred_t;
+
+static uint8_t oath_page[OATH_PAGE_SIZE];
+
+/*
+ * Set while credentials of older firmwares may still be stored one per file
+ * (EF_OATH_CRED + n). oath_cred_next() returns them after the paged ones, as
+ * pages OATH_PAGES + n, until oath_migrate_legacy() has moved all of them.
+ */
+static bool oath_legacy = true;
+#define OATH_LEGACY_FILES   (EF_OATH_CODE - EF_OATH_CRED)
+
+static bool oath_cred_parse_legacy(oath_cred_t *c) {
+    asn1_ctx_t ctxi, key = { 0 }, name = { 0 }, imf = { 0 }, prop = { 0 };
+    asn1_ctx_init(file_get_data(c->ef), file_get_size(c->ef), &ctxi);
+    if (asn1_find_tag(&ctxi, TAG_KEY, &key) == false || key.len < 2 || key.len > 0xFF) {
+        return false;
+    }
+    if (asn1_find_tag(&ctxi, TAG_NAME, &name) == false || name.len > 0xFF) {
+        return false;
+    }
+    c->len = file_get_size(c->ef);
+    c->name_len = (uint8_t)name.len;
+    c->key_len = (uint8_t)key.len;
+    c->prop = 0;
+    if (asn1_find_tag(&ctxi, TAG_PROPERTY, &prop) == true && prop.len > 0) {
+        c->prop = prop.data[0];
+    }
+    c->flags = 0;
+    c->name = name.data;
+    c->key = key.data;
+    c->imf = NULL;
+    c->imf_ef = NULL;
+    if (asn1_find_tag(&ctxi, TAG_IMF, &imf) == true && imf.len == 8) {
+        c->imf = imf.data;
+        c->imf_ef = c->ef;
+    }
+    return true;
+}
+
+static bool oath_cred_next(oath_cred_t *c) {
+    if (c->ef) {
+        c->off += c->len;
+    }
+    else {
+        c->page = 0;
+        c->off = 0;
+    }
+    for (; c->page < OATH_PAGES; c->page++, c->off = 0) {
+        c->ef = oath_slots[c->page];
+        if (!file_has_data(c->ef)) {
+            continue;
+        }
+        uint16_t size = file_get_size(c->ef);
+        if (c->off + sizeof(oath_hdr_t) > size) {
+            continue;
+        }
+        const uint8_t *p = file_get_data(c->ef) + c->off;
+        const oath_hdr_t *hdr = (const oath_hdr_t *)p;
+        c->len = (uint16_t)(sizeof(oath_hdr_t) + hdr->name_len + hdr->key_len + (hdr->flags & OATH_FLAG_IMF ? 1 : 0));
+        if (c->off + c->len > size) {
+            continue;
+        }
+        c->name_len = hdr->name_len;
+        c->key_len = hdr->key_len;
+        c->prop = hdr->prop;
+        c->flags = hdr->flags;
+        c->name = p + sizeof(oath_hdr_t);
+        c->key = c->name + c->name_len;
+        c->imf_id = hdr->flags & OATH_FLAG_IMF ? c->key[c->key_len] : 0;
+        // Looked up by oath_cred_imf() only when needed
+        c->imf = NULL;
+        c->imf_ef = NULL;
+        return true;
+    }
+    for (; oath_legacy && c->page < OATH_PAGES + OATH_LEGACY_FILES; c->page++, c->off = 0) {
+        if (c->off > 0) { // already returned
+            continue;
+        }
+        c->ef = search_dynamic_file((uint16_t)(EF_OATH_CRED + c->page - OATH_PAGES));
+        if (file_has_data(c->ef) && oath_cred_parse_legacy(c)) {
+            return true;
         }
     }
-    return NULL;
+    c->ef = NULL;
+    return false;
 }
 
-int cmd_put() {
-    if (validated == false) {
-        return SW_SECURITY_STATUS_NOT_SATISFIED();
+static bool find_oath_cred(const uint8_t *name, size_t name_len, oath_cred_t *c) {
+    memset(c, 0, sizeof(oath_cred_t));
+    while (oath_cred_next(c)) {
+        if (c->name_len == name_len && memcmp(c->name, name, name_len) == 0) {
+            return true;
+        }
     }
-    asn1_ctx_t ctxi, key = { 0 }, name = { 0 }, imf = { 0 };
-    asn1_ctx_init(apdu.data, (uint16_t)apdu.nc, &ctxi);
-    if (asn1_find_tag(&ctxi, TAG_KEY, &key) == false) {
-        return SW_INCORRECT_PARAMS();
+    return false;
+}
+
+// Points c->imf at the IMF file of a paged HOTP record. Legacy records carry it inline.
+static void oath_cred_imf(oath_cred_t *c) {
+    if (c->page < OATH_PAGES && (c->flags & OATH_FLAG_IMF)) {
+        c->imf_ef = search_dynamic_file((uint16_t)(EF_OATH_IMF + c->imf_id));
+        c->imf = file_has_data(c->imf_ef) && file_get_size(c->imf_ef) == 8 ? file_get_data(c->imf_ef) : NULL;
     }
-    if (asn1_find_tag(&ctxi, TAG_NAME, &name) == false) {
-        return SW_INCORRECT_PARAMS();
+}
+
+// Writes imf to a free IMF file and returns its id, or -1 when all are taken.
+static int oath_imf_new(const uint8_t *imf) {
+    uint32_t used[SLOT_MAP_WORDS(OATH_IMF_FILES)] = { 0 };
+    oath_cred_t c = { 0 };
+    while (oath_cred_next(&c) && c.page < OATH_PAGES) {
+        if (c.flags & OATH_FLAG_IMF) {
+            used[c.imf_id / 32] |= 1u << (c.imf_id % 32);
+        }
     }
-    if ((key.data[0] & OATH_TYPE_MASK) == OATH_TYPE_HOTP) {
-        if (asn1_find_tag(&ctxi, TAG_IMF, &imf) == false) {
-            memcpy(apdu.data + apdu.nc, "\x7a\x08\x00\x00\x00\x00\x00\x00\x00\x00", 10);
-            apdu.nc += 10;
+    int id = slot_map_first_free(used, OATH_IMF_FILES);
+    if (id >= 0) {
+        file_put_data(file_new((uint16_t)(EF_OATH_IMF + id)), imf, 8);
+        low_flash_available();
+    }
+    return id;
+}
+
+static void oath_imf_delete(uint8_t id) {
+    slot_delete_file(search_dynamic_file((uint16_t)(EF_OATH_IMF + id)));
+    low_flash_available();
+}
+
+static void oath_page_write(uint8_t page, const uint8_t *data, uint16_t len) {
+    if (len == 0) {
+        slot_delete_file(oath_slots[page]);
+    }
+    else {
+        file_put_data(slot_file_new((uint16_t)(EF_OATH_PAGE + page)), data, len);
+    }
+    low_flash_available();
+}
+
+// Drops a record from its page, compacting the remaining ones in the same write.
+static void oath_cred_remove(const oath_cred_t *c) {
+    if (c->page >= OATH_PAGES) {
+        slot_delete_file(search_dynamic_file((uint16_t)(EF_OATH_CRED + c->page - OATH_PAGES)));
+        low_flash_available();
+        return;
+    }
+    uint16_t size = file_get_size(c->ef);
+    memcpy(oath_page, file_get_data(c->ef), size);
+    memmove(oath_page + c->off, oath_page + c->off + c->len, size - c->off - c->len);
+    oath_page_write((uint8_t)c->page, oath_page, size - c->len);
+    if (c->flags & OATH_FLAG_IMF) {
+        oath_imf_delete(c->imf_id);
+    }
+}
+
+// With replace, the credential being replaced is still stored and is not counted.
+static int oath_cred_append(const uint8_t *rec, uint16_t rec_len, bool replace) {
+    uint16_t creds = 0;
+    oath_cred_t c = { 0 };
+    while (oath_cred_next(&c)) {
+        creds++;
+    }
+    if (creds >= MAX_OATH_CRED + (replace ? 1 : 0)) {
+        return PICOKEY_ERR_NO_MEMORY;
+    }
+    for (uint8_t page = 0; page < OATH_PAGES; page++) {
+        file_t *ef = oath_slots[page];
+        uint16_t size = file_has_data(ef) ? file_get_size(ef) : 0;
+        if (size + rec_len <= OATH_PAGE_SIZE) {
+            memcpy(oath_page, file_get_data(ef), size);
+            memcpy(oath_page + size, rec, rec_len);
+            oath_page_write(page, oath_page, size + rec_len);
+            return PICOKEY_OK;
         }
-        else { //prepend zero-valued bytes
-            if (imf.len < 8) {
-                memmove(imf.data + (8 - imf.len), imf.data, imf.len);
-                memset(imf.data, 0, 8 - imf.len);
-                *(imf.data - 1) = 8;
-                apdu.nc += (8 - imf.len);
+    }
+    return PICOKEY_ERR_NO_MEMORY;
+}
+
+// For HOTP, the initial IMF goes to imf and the record ends with a placeholder id.
+static uint16_t oath_cred_pack(const uint8_t *data, uint16_t len, uint8_t *rec, uint8_t *imf_out) {
+    asn1_ctx_t ctxi, key = { 0 }, name = { 0 }, imf = { 0 }, prop = { 0 };
+    asn1_ctx_init((uint8_t *)data, len, &ctxi);
+    if (asn1_find_tag(&ctxi, TAG_KEY, &key) == false || key.len < 2 || key.len > 0xFF) {
+        return 0;
+    }
+    if (asn1_find_tag(&ctxi, TAG_NAME, &name) == false || name.len > 0xFF) {
+        return 0;
+    }
+    oath_hdr_t *hdr = (oath_hdr_t *)rec;
+    hdr->name_len = (uint8_t)name.len;
+    hdr->key_len = (uint8_t)key.len;
+    hdr->prop = 0;
+    hdr->flags = 0;
+    if (asn1_find_tag(&ctxi, TAG_PROPERTY, &prop) == true && prop.len > 0) {
+        hdr->prop = prop.data[0];
+    }
+    uint16_t rec_len = sizeof(oath_hdr_t);
+    memcpy(rec + rec_len, name.data, name.len); rec_len += name.len;
+    memcpy(rec + rec_len, key.data, key.len); rec_len += key.len;
+    if ((key.data[0] & OATH_TYPE_MASK) == OATH_TYPE_HOTP) {
+        hdr->flags |= OATH_FLAG_IMF;
+        memset(imf_out, 0, 8);
+        if (asn1_find_tag(&ctxi, TAG_IMF, &imf) == true) {
+            if (imf.len > 8) {
+                return 0;
             }
+            //prepend zero-valued bytes
+            memcpy(imf_out + (8 - imf.len), imf.data, imf.len);
+        }
+        rec[rec_len++] = 0;
+    }
+    return rec_len;
+}
 
+// Packs a credential and, for HOTP, writes its IMF file.
+static int oath_cred_prepare(const uint8_t *data, uint16_t len, uint8_t *rec, uint16_t *rec_len) {
+    uint8_t imf[8];
+    *rec_len = oath_cred_pack(data, len, rec, imf);
+    if (*rec_len == 0) {
+        return PICOKEY_ERR_INVALID_PARAMETER;
+    }
+    if (((oath_hdr_t *)rec)->flags & OATH_FLAG_IMF) {
+        int id = oath_imf_new(imf);
+        if (id < 0) {
+            return PICOKEY_ERR_NO_MEMORY;
         }
+        rec[*rec_len - 1] = (uint8_t)id;
     }
-    file_t *ef = find_oath_cred(name.data, name.len);
-    if (file_has_data(ef)) {
-        file_put_data(ef, apdu.data, (uint16_t)apdu.nc);
-        low_flash_available();
+    return PICOKEY_OK;
+}
+
+// Drops the IMF file of a prepared record that could not be stored.
+static void oath_cred_discard(const uint8_t *rec, uint16_t rec_len) {
+    if (((const oath_hdr_t *)rec)->flags & OATH_FLAG_IMF) {
+        oath_imf_delete(rec[rec_len - 1]);
     }
-    else {
-        for (int i = 0; i < MAX_OATH_CRED; i++) {
-            file_t *tef = search_dynamic_file((uint16_t)(EF_OATH_CRED + i));
-            if (!file_has_data(tef)) {
-                tef = file_new((uint16_t)(EF_OATH_CRED + i));
-                file_put_data(tef, apdu.data, (uint16_t)apdu.nc);
-                low_flash_available();
-                return SW_OK();
+}
+
+/*
+ * Moves credentials stored one per file by older firmwares into the packed
+ * store. The ones that do not fit stay in their files, where they are still
+ * listed and used, and are moved on a later select once room is freed.
+ */
+static void oath_migrate_legacy() {
+    if (oath_legacy == false) {
+        return;
+    }
+    bool left = false;
+    uint8_t rec[sizeof(oath_hdr_t) + 0xFF + 0xFF + 1];
+    for (uint16_t fid = EF_OATH_CRED; fid < EF_OATH_CODE; fid++) {
+        file_t *ef = search_dynamic_file(fid);
+        if (file_has_data(ef)) {
+            uint16_t rec_len = 0;
+            int ret = oath_cred_prepare(file_get_data(ef), file_get_size(ef), rec, &rec_len);
+            if (ret == PICOKEY_ERR_NO_MEMORY) {
+                left = true;
+                continue;
+            }
+            if (ret == PICOKEY_OK && oath_cred_append(rec, rec_len, false) != PICOKEY_OK) {
+                oath_cred_discard(rec, rec_len);
+                left = true;
+                continue;
             }
+            slot_delete_file(search_dynamic_file(fid));
+            low_flash_available();
         }
+    }
+    oath_legacy = left;
+}
+
+int cmd_put() {
+    if (validated == false) {
+        return SW_SECURITY_STATUS_NOT_SATISFIED();
+    }
+    uint8_t rec[sizeof(oath_hdr_t) + 0xFF + 0xFF + 1];
+    uint16_t rec_len = 0;
+    int ret = oath_cred_prepare(apdu.data, (uint16_t)apdu.nc, rec, &rec_len);
+    if (ret == PICOKEY_ERR_NO_MEMORY) {
+        return SW_FILE_FULL();
+    }
+    if (ret != PICOKEY_OK) {
+        return SW_INCORRECT_PARAMS();
+    }
+    oath_cred_t c;
+    if (find_oath_cred(rec + sizeof(oath_hdr_t), rec[0], &c)) {
+        uint16_t size = file_get_size(c.ef);
+        if (c.page < OATH_PAGES && size - c.len + rec_len <= OATH_PAGE_SIZE) {
+            memcpy(oath_page, file_get_data(c.ef), size);
+            memmove(oath_page + c.off + rec_len, oath_page + c.off + c.len, size - c.off - c.len);
+            memcpy(oath_page + c.off, rec, rec_len);
+            oath_page_write((uint8_t)c.page, oath_page, size - c.len + rec_len);
+            if (c.flags & OATH_FLAG_IMF) {
+                oath_imf_delete(c.imf_id);
+            }
+            return SW_OK();
+        }
+        // The new record goes to another page first, so a full store keeps the old one
+        if (oath_cred_append(rec, rec_len, true) != PICOKEY_OK) {
+            oath_cred_discard(rec, rec_len);
+            return SW_FILE_FULL();
+        }
+        oath_cred_remove(&c);
+        return SW_OK();
+    }
+    if (oath_cred_append(rec, rec_len, false) != PICOKEY_OK) {
+        oath_cred_discard(rec, rec_len);
         return SW_FILE_FULL();
     }
     return SW_OK();
 }
 
-
 int cmd_delete() {
     if (validated == false) {
         return SW_SECURITY_STATUS_NOT_SATISFIED();
@@ -146,9 +459,9 @@ int cmd_delete() {
     asn1_ctx_t ctxi, ctxo = { 0 };
     asn1_ctx_init(apdu.data, (uint16_t)apdu.nc, &ctxi);
     if (asn1_find_tag(&ctxi, TAG_NAME, &ctxo) == true) {
-        file_t *ef = find_oath_cred(ctxo.data, ctxo.len);
-        if (ef) {
-            delete_file(ef);
+        oath_cred_t c;
+        if (find_oath_cred(ctxo.data, ctxo.len, &c)) {
+            oath_cred_remove(&c);
             return SW_OK();
         }
         return SW_DATA_INVALID();
@@ -174,7 +487,7 @@ int cmd_set_code() {
         return SW_SECURITY_STATUS_NOT_SATISFIED();
     }
     if (apdu.nc == 0) {
-        delete_file(search_dynamic_file(EF_OATH_CODE));
+        slot_delete_file(search_dynamic_file(EF_OATH_CODE));
         validated = true;
         return SW_OK();
     }
@@ -184,7 +497,7 @@ int cmd_set_code() {
         return SW_INCORRECT_PARAMS();
     }
     if (key.len == 0) {
-        delete_file(search_dynamic_file(EF_OATH_CODE));
+        slot_delete_file(search_dynamic_file(EF_OATH_CODE));
         validated = true;
         return SW_OK();
     }
@@ -200,7 +513,7 @@ int cmd_set_code() {
         return SW_INCORRECT_PARAMS();
     }
     uint8_t hmac[64];
-    int r = mbedtls_md_hmac(md_info, key.data + 1, key.len - 1, chal.data, chal.len, hmac);
+    int r = hash_md_hmac(md_info, key.data + 1, key.len - 1, chal.data, chal.len, hmac);
     if (r != 0) {
         return SW_EXEC_ERROR();
     }
@@ -219,40 +532,82 @@ int cmd_reset() {
     if (P1(apdu) != 0xde || P2(apdu) != 0xad) {
         return SW_INCORRECT_P1P2();
     }
-    for (int i = 0; i < MAX_OATH_CRED; i++) {
-        file_t *ef = search_dynamic_file((uint16_t)(EF_OATH_CRED + i));
+    for (uint16_t fid = EF_OATH_CRED; fid < EF_OATH_CODE; fid++) {
+        file_t *ef = search_dynamic_file(fid);
         if (file_has_data(ef)) {
-            delete_file(ef);
+            slot_delete_file(ef);
         }
     }
-    delete_file(search_dynamic_file(EF_OATH_CODE));
+    for (uint8_t page = 0; page < OATH_PAGES; page++) {
+        if (file_has_data(oath_slots[page])) {
+            slot_delete_file(oath_slots[page]);
+        }
+    }
+    for (uint16_t id = 0; id < OATH_IMF_FILES; id++) {
+        file_t *ef = search_dynamic_file((uint16_t)(EF_OATH_IMF + id));
+        if (ef) {
+            slot_delete_file(ef);
+        }
+    }
+    slot_delete_file(search_dynamic_file(EF_OATH_CODE));
+    oath_legacy = false;
     flash_clear_file(search_by_fid(EF_OTP_PIN, NULL, SPECIFY_EF));
     low_flash_available();
     validated = true;
     return SW_OK();
 }
 
-int cmd_list() {
-    if (validated == false) {
-        return SW_SECURITY_STATUS_NOT_SATISFIED();
-    }
-    for (int i = 0; i < MAX_OATH_CRED; i++) {
-        file_t *ef = search_dynamic_file((uint16_t)(EF_OATH_CRED + i));
-        if (file_has_data(ef)) {
-            asn1_ctx_t ctxi, key = { 0 }, name = { 0 };
-            asn1_ctx_init(file_get_data(ef), file_get_size(ef), &ctxi);
-            if (asn1_find_tag(&ctxi, TAG_NAME, &name) == true && asn1_find_tag(&ctxi, TAG_KEY, &key) == true) {
-                res_APDU[res_APDU_size++] = TAG_NAME_LIST;
-                res_APDU[res_APDU_size++] = (uint8_t)(name.len + 1);
-                res_APDU[res_APDU_size++] = key.data[0];
-                memcpy(res_APDU + res_APDU_size, name.data, name.len); res_APDU_size += name.len;
-            }
+/*
+ * LIST and CALCULATE ALL answer with at most OATH_RESP_MAX bytes. When more
+ * credentials remain, the position of the next one is kept in oath_more and
+ * SW 6100 is returned, so SEND REMAINING resumes from there. Any other command
+ * drops the cursor.
+ */
+#define OATH_RESP_MAX       1024
+
+static struct {
+    uint8_t ins;
+    uint8_t p2;
+    uint8_t chal_len;
+    uint8_t chal[64];
+    oath_cred_t c;
+} oath_more = { 0 };
+
+static void oath_more_clear() {
+    oath_more.ins = 0;
+}
+
+static int oath_more_save(uint8_t ins, const oath_cred_t *c) {
+    oath_more.ins = ins;
+    oath_more.c = *c;
+    // oath_cred_next() returns this same record again
+    oath_more.c.len = 0;
+    apdu.ne = res_APDU_size;
+    return SW_BYTES_REMAINING_00();
+}
+
+static int oath_list_from(oath_cred_t *c) {
+    while (oath_cred_next(c)) {
+        if (res_APDU_size + 3 + c->name_len > OATH_RESP_MAX) {
+            return oath_more_save(INS_LIST, c);
         }
+        res_APDU[res_APDU_size++] = TAG_NAME_LIST;
+        res_APDU[res_APDU_size++] = c->name_len + 1;
+        res_APDU[res_APDU_size++] = c->key[0];
+        memcpy(res_APDU + res_APDU_size, c->name, c->name_len); res_APDU_size += c->name_len;
     }
     apdu.ne = res_APDU_size;
     return SW_OK();
 }
 
+int cmd_list() {
+    if (validated == false) {
+        return SW_SECURITY_STATUS_NOT_SATISFIED();
+    }
+    oath_cred_t c = { 0 };
+    return oath_list_from(&c);
+}
+
 int cmd_validate() {
     asn1_ctx_t ctxi, key = { 0 }, chal = { 0 }, resp = { 0 };
     asn1_ctx_init(apdu.data, (uint16_t)apdu.nc, &ctxi);
@@ -274,14 +629,14 @@ int cmd_validate() {
         return SW_INCORRECT_PARAMS();
     }
     uint8_t hmac[64];
-    int ret = mbedtls_md_hmac(md_info, key.data + 1, key.len - 1, challenge, sizeof(challenge), hmac);
+    int ret = hash_md_hmac(md_info, key.data + 1, key.len - 1, challenge, sizeof(challenge), hmac);
     if (ret != 0) {
         return SW_EXEC_ERROR();
     }
     if (memcmp(hmac, resp.data, resp.len) != 0) {
         return SW_DATA_INVALID();
     }
-    ret = mbedtls_md_hmac(md_info, key.data + 1, key.len - 1, chal.data, chal.len, hmac);
+    ret = hash_md_hmac(md_info, key.data + 1, key.len - 1, chal.data, chal.len, hmac);
     if (ret != 0) {
         return SW_EXEC_ERROR();
     }
@@ -300,7 +655,7 @@ int calculate_oath(uint8_t truncate, const uint8_t *key, size_t key_len, const u
         return SW_INCORRECT_PARAMS();
     }
     uint8_t hmac[64];
-    int r = mbedtls_md_hmac(md_info, key + 2, key_len - 2, chal, chal_len, hmac);
+    int r = hash_md_hmac(md_info, key + 2, key_len - 2, chal, chal_len, hmac);
     size_t hmac_size = mbedtls_md_get_size(md_info);
     if (r != 0) {
         return PICOKEY_EXEC_ERROR;
@@ -330,7 +685,7 @@ int cmd_calculate() {
     if (validated == false) {
         return SW_SECURITY_STATUS_NOT_SATISFIED();
     }
-    asn1_ctx_t ctxi, key = { 0 }, chal = { 0 }, name = { 0 };
+    asn1_ctx_t ctxi, chal = { 0 }, name = { 0 };
     asn1_ctx_init(apdu.data, (uint16_t)apdu.nc, &ctxi);
     if (asn1_find_tag(&ctxi, TAG_CHALLENGE, &chal) == false) {
         return SW_INCORRECT_PARAMS();
@@ -338,63 +693,84 @@ int cmd_calculate() {
     if (asn1_find_tag(&ctxi, TAG_NAME, &name) == false) {
         return SW_INCORRECT_PARAMS();
     }
-    file_t *ef = find_oath_cred(name.data, name.len);
-    if (file_has_data(ef) == false) {
+    oath_cred_t c;
+    if (find_oath_cred(name.data, name.len, &c) == false) {
         return SW_DATA_INVALID();
     }
-    asn1_ctx_t ctxe;
-    asn1_ctx_init(file_get_data(ef), file_get_size(ef), &ctxe);
-    if (asn1_find_tag(&ctxe, TAG_KEY, &key) == false) {
-        return SW_INCORRECT_PARAMS();
-    }
 
-    if ((key.data[0] & OATH_TYPE_MASK) == OATH_TYPE_HOTP) {
-        if (asn1_find_tag(&ctxe, TAG_IMF, &chal) == false) {
+    const uint8_t *chal_data = chal.data;
+    uint16_t chal_len = chal.len;
+    if ((c.key[0] & OATH_TYPE_MASK) == OATH_TYPE_HOTP) {
+        oath_cred_imf(&c);
+        if (c.imf == NULL) {
             return SW_INCORRECT_PARAMS();
         }
+        // Legacy files are not bounded by the page size
+        if (c.page >= OATH_PAGES && file_get_size(c.ef) > sizeof(oath_page)) {
+            return SW_EXEC_ERROR();
+        }
+        chal_data = c.imf;
+        chal_len = 8;
     }
 
     res_APDU[res_APDU_size++] = TAG_RESPONSE + P2(apdu);
 
-    int ret = calculate_oath(P2(apdu), key.data, key.len, chal.data, chal.len);
+    int ret = calculate_oath(P2(apdu), c.key, c.key_len, chal_data, chal_len);
     if (ret != PICOKEY_OK) {
         return SW_EXEC_ERROR();
     }
-    if ((key.data[0] & OATH_TYPE_MASK) == OATH_TYPE_HOTP) {
-        uint64_t v =
-            ((uint64_t) chal.data[0] << 56) |
-            ((uint64_t) chal.data[1] << 48) |
-            ((uint64_t) chal.data[2] << 40) |
-            ((uint64_t) chal.data[3] << 32) |
-            ((uint64_t) chal.data[4] << 24) |
-            ((uint64_t) chal.data[5] << 16) |
-            ((uint64_t) chal.data[6] << 8) |
-            (uint64_t) chal.data[7];
-        size_t ef_size = file_get_size(ef);
-        v++;
-        uint8_t *tmp = (uint8_t *) calloc(1, ef_size);
-        memcpy(tmp, file_get_data(ef), ef_size);
-        asn1_ctx_t ctxt;
-        asn1_ctx_init(tmp, (uint16_t)ef_size, &ctxt);
-        asn1_find_tag(&ctxt, TAG_IMF, &chal);
-        chal.data[0] = (v >> 56) & 0xFF;
-        chal.data[1] = (v >> 48) & 0xFF;
-        chal.data[2] = (v >> 40) & 0xFF;
-        chal.data[3] = (v >> 32) & 0xFF;
-        chal.data[4] = (v >> 24) & 0xFF;
-        chal.data[5] = (v >> 16) & 0xFF;
-        chal.data[6] = (v >> 8) & 0xFF;
-        chal.data[7] = v & 0xff;
-        file_put_data(ef, tmp, (uint16_t)ef_size);
+    if ((c.key[0] & OATH_TYPE_MASK) == OATH_TYPE_HOTP) {
+        // The IMF file, or the whole legacy file that holds it
+        uint16_t ef_size = file_get_size(c.imf_ef);
+        memcpy(oath_page, file_get_data(c.imf_ef), ef_size);
+        uint8_t *imf = oath_page + (c.imf - file_get_data(c.imf_ef));
+        for (int i = 7; i >= 0; i--) {
+            if (++imf[i] != 0) {
+                break;
+            }
+        }
+        file_put_data(c.imf_ef, oath_page, ef_size);
         low_flash_available();
-        free(tmp);
+    }
+    apdu.ne = res_APDU_size;
+    return SW_OK();
+}
+
+static int oath_calculate_all_from(oath_cred_t *c) {
+    uint8_t p2 = oath_more.p2;
+    while (oath_cred_next(c)) {
+        // name, plus the longest response (HMAC-SHA512)
+        if (res_APDU_size + 2 + c->name_len + 3 + 64 > OATH_RESP_MAX) {
+            return oath_more_save(INS_CALC_ALL, c);
+        }
+        res_APDU[res_APDU_size++] = TAG_NAME;
+        res_APDU[res_APDU_size++] = c->name_len;
+        memcpy(res_APDU + res_APDU_size, c->name, c->name_len); res_APDU_size += c->name_len;
+        if ((c->key[0] & OATH_TYPE_MASK) == OATH_TYPE_HOTP) {
+            res_APDU[res_APDU_size++] = TAG_NO_RESPONSE;
+            res_APDU[res_APDU_size++] = 1;
+            res_APDU[res_APDU_size++] = c->key[1];
+        }
+        else if (c->prop & PROP_TOUCH) {
+            res_APDU[res_APDU_size++] = TAG_TOUCH_RESPONSE;
+            res_APDU[res_APDU_size++] = 1;
+            res_APDU[res_APDU_size++] = c->key[1];
+        }
+        else {
+            res_APDU[res_APDU_size++] = TAG_RESPONSE + p2;
+            int ret = calculate_oath(p2, c->key, c->key_len, oath_more.chal, oath_more.chal_len);
+            if (ret != PICOKEY_OK) {
+                res_APDU[res_APDU_size++] = 1;
+                res_APDU[res_APDU_size++] = c->key[1];
+            }
+        }
     }
     apdu.ne = res_APDU_size;
     return SW_OK();
 }
 
 int cmd_calculate_all() {
-    asn1_ctx_t ctxi, key = { 0 }, chal = { 0 }, name = { 0 }, prop = { 0 };
+    asn1_ctx_t ctxi, chal = { 0 };
     asn1_ctx_init(apdu.data, (uint16_t)apdu.nc, &ctxi);
     if (P2(apdu) != 0x0 && P2(apdu) != 0x1) {
         return SW_INCORRECT_P1P2();
@@ -402,48 +778,30 @@ int cmd_calculate_all() {
     if (validated == false) {
         return SW_SECURITY_STATUS_NOT_SATISFIED();
     }
-    if (asn1_find_tag(&ctxi, TAG_CHALLENGE, &chal) == false) {
+    if (asn1_find_tag(&ctxi, TAG_CHALLENGE, &chal) == false || chal.len > sizeof(oath_more.chal)) {
         return SW_INCORRECT_PARAMS();
     }
+    // Kept for SEND REMAINING
+    oath_more.p2 = P2(apdu);
+    oath_more.chal_len = (uint8_t)chal.len;
+    memcpy(oath_more.chal, chal.data, chal.len);
     res_APDU_size = 0;
-    for (int i = 0; i < MAX_OATH_CRED; i++) {
-        file_t *ef = search_dynamic_file((uint16_t)(EF_OATH_CRED + i));
-        if (file_has_data(ef)) {
-            const uint8_t *ef_data = file_get_data(ef);
-            size_t ef_len = file_get_size(ef);
-            asn1_ctx_t ctxe;
-            asn1_ctx_init((uint8_t *)ef_data, (uint16_t)ef_len, &ctxe);
-            if (asn1_find_tag(&ctxe, TAG_NAME, &name) == false || asn1_find_tag(&ctxe, TAG_KEY, &key) == false) {
-                continue;
-            }
-            res_APDU[res_APDU_size++] = TAG_NAME;
-            res_APDU[res_APDU_size++] = (uint8_t)name.len;
-            memcpy(res_APDU + res_APDU_size, name.data, name.len); res_APDU_size += name.len;
-            if ((key.data[0] & OATH_TYPE_MASK) == OATH_TYPE_HOTP) {
-                res_APDU[res_APDU_size++] = TAG_NO_RESPONSE;
-                res_APDU[res_APDU_size++] = 1;
-                res_APDU[res_APDU_size++] = key.data[1];
-            }
-            else if (asn1_find_tag(&ctxe, TAG_PROPERTY, &prop) == true && (prop.data[0] & PROP_TOUCH)) {
-                res_APDU[res_APDU_size++] = TAG_TOUCH_RESPONSE;
-                res_APDU[res_APDU_size++] = 1;
-                res_APDU[res_APDU_size++] = key.data[1];
-            }
-            else {
-                res_APDU[res_APDU_size++] = TAG_RESPONSE + P2(apdu);
-                int ret = calculate_oath(P2(apdu), key.data, key.len, chal.data, chal.len);
-                if (ret != PICOKEY_OK) {
-                    res_APDU[res_APDU_size++] = 1;
-                    res_APDU[res_APDU_size++] = key.data[1];
-                }
-            }
-        }
-    }
-    apdu.ne = res_APDU_size;
-    return SW_OK();
+    oath_cred_t c = { 0 };
+    return oath_calculate_all_from(&c);
 }
 
 int cmd_send_remaining() {
+    uint8_t ins = oath_more.ins;
+    oath_more_clear();
+    if (validated == false) {
+        return SW_SECURITY_STATUS_NOT_SATISFIED();
+    }
+    if (ins == INS_LIST) {
+        return oath_list_from(&oath_more.c);
+    }
+    if (ins == INS_CALC_ALL) {
+        return oath_calculate_all_from(&oath_more.c);
+    }
     return SW_OK();
 }
 
@@ -520,33 +878,28 @@ int cmd_verify_otp_pin() {
 }
 
 int cmd_verify_hotp() {
-    asn1_ctx_t ctxi, key = { 0 }, chal = { 0 }, name = { 0 }, code = { 0 };
+    asn1_ctx_t ctxi, name = { 0 }, code = { 0 };
     asn1_ctx_init(apdu.data, (uint16_t)apdu.nc, &ctxi);
     uint32_t code_int = 0;
     if (asn1_find_tag(&ctxi, TAG_NAME, &name) == false) {
         return SW_INCORRECT_PARAMS();
     }
-    file_t *ef = find_oath_cred(name.data, name.len);
-    if (file_has_data(ef) == false) {
+    oath_cred_t c;
+    if (find_oath_cred(name.data, name.len, &c) == false) {
         return SW_DATA_INVALID();
     }
-    asn1_ctx_t ctxe;
-    asn1_ctx_init(file_get_data(ef), file_get_size(ef), &ctxe);
-    if (asn1_find_tag(&ctxe, TAG_KEY, &key) == false) {
-        return SW_INCORRECT_PARAMS();
-    }
-
-    if ((key.data[0] & OATH_TYPE_MASK) != OATH_TYPE_HOTP) {
+    if ((c.key[0] & OATH_TYPE_MASK) != OATH_TYPE_HOTP) {
         return SW_DATA_INVALID();
     }
-    if (asn1_find_tag(&ctxe, TAG_IMF, &chal) == false) {
+    oath_cred_imf(&c);
+    if (c.imf == NULL) {
         return SW_INCORRECT_PARAMS();
     }
     if (asn1_find_tag(&ctxi, TAG_RESPONSE, &code) == true) {
         code_int = (code.data[0] << 24) | (code.data[1] << 16) | (code.data[2] << 8) | code.data[3];
     }
 
-    int ret = calculate_oath(0x01, key.data, key.len, chal.data, chal.len);
+    int ret = calculate_oath(0x01, c.key, c.key_len, c.imf, 8);
     if (ret != PICOKEY_OK) {
         return SW_EXEC_ERROR();
     }
@@ -565,20 +918,6 @@ int cmd_verify_hotp() {
     return SW_OK();
 }
 
-#define INS_PUT             0x01
-#define INS_DELETE          0x02
-#define INS_SET_CODE        0x03
-#define INS_RESET           0x04
-#define INS_LIST            0xa1
-#define INS_CALCULATE       0xa2
-#define INS_VALIDATE        0xa3
-#define INS_CALC_ALL        0xa4
-#define INS_SEND_REMAINING  0xa5
-#define INS_VERIFY_CODE     0xb1
-#define INS_VERIFY_PIN      0xb2
-#define INS_CHANGE_PIN      0xb3
-#define INS_SET_PIN         0xb4
-
 static const cmd_t cmds[] = {
     { INS_PUT, cmd_put },
     { INS_DELETE, cmd_delete },
@@ -601,6 +940,9 @@ int oath_process_apdu() {
         return SW_CLA_NOT_SUPPORTED();
     }
     if (cap_supported(CAP_OATH)) {
+        if (INS(apdu) != INS_SEND_REMAINING) {
+            oath_more_clear();
+        }
         for (const cmd_t *cmd = cmds; cmd->ins != 0x00; cmd++) {
             if (cmd->ins == INS(apdu)) {
                 int r = cmd->cmd_handler();
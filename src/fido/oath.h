@@ -1,7 +1,9 @@
 #ifndef OATH_H
 #define OATH_H
 
-#define MAX_OATH_CRED   255
+#define MAX_OATH_CRED   512
+#define OATH_PAGE_SIZE  2048
+#define OATH_PAGES      32
 #define CHALLENGE_LEN   8
 #define MAX_OTP_COUNTER 3
 
@@ -28,6 +28,8 @@
 #include "bsp/board.h"
 #endif
 #include "mbedtls/aes.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/platform_util.h"
 #include "management.h"
 #ifndef ENABLE_EMULATION
 #include "tusb.h"
@@ -83,7 +85,104 @@ int encode_modhex(const uint8_t *in, size_t len, uint8_t *out) {
 
 static bool scanned = false;
 
+/*
+ * Expanded AES-128 round keys for each slot, so a button press or a Yubico
+ * challenge only runs the block encryption, and the SHA-1 states after the
+ * HMAC inner and outer pads, so an HMAC-SHA1 challenge only hashes the
+ * challenge and the inner digest. Wiped when the slot changes or is reset.
+ */
+typedef struct {
+    mbedtls_sha1_context inner;
+    mbedtls_sha1_context outer;
+} otp_hmac_ctx_t;
+
+static mbedtls_aes_context otp_aes_ctx[2];
+static bool otp_aes_valid[2] = { false, false };
+static otp_hmac_ctx_t otp_hmac_ctx[2];
+static bool otp_hmac_valid[2] = { false, false };
+
+static void otp_keys_invalidate(uint8_t slot) {
+    if (otp_aes_valid[slot - 1]) {
+        mbedtls_aes_free(&otp_aes_ctx[slot - 1]);
+        otp_aes_valid[slot - 1] = false;
+    }
+    if (otp_hmac_valid[slot - 1]) {
+        mbedtls_sha1_free(&otp_hmac_ctx[slot - 1].inner);
+        mbedtls_sha1_free(&otp_hmac_ctx[slot - 1].outer);
+        otp_hmac_valid[slot - 1] = false;
+    }
+    mbedtls_platform_zeroize(&otp_aes_ctx[slot - 1], sizeof(otp_aes_ctx[slot - 1]));
+    mbedtls_platform_zeroize(&otp_hmac_ctx[slot - 1], sizeof(otp_hmac_ctx[slot - 1]));
+}
+
+static mbedtls_aes_context *otp_aes_get(uint8_t slot, const otp_config_t *otp_config) {
+    if (otp_aes_valid[slot - 1] == false) {
+        mbedtls_aes_init(&otp_aes_ctx[slot - 1]);
+        if (mbedtls_aes_setkey_enc(&otp_aes_ctx[slot - 1], otp_config->aes_key, 128) != 0) {
+            mbedtls_aes_free(&otp_aes_ctx[slot - 1]);
+            return NULL;
+        }
+        otp_aes_valid[slot - 1] = true;
+    }
+    return &otp_aes_ctx[slot - 1];
+}
+
+static otp_hmac_ctx_t *otp_hmac_get(uint8_t slot, const otp_config_t *otp_config) {
+    otp_hmac_ctx_t *hmac = &otp_hmac_ctx[slot - 1];
+    if (otp_hmac_valid[slot - 1] == false) {
+        uint8_t pad[64];
+        mbedtls_sha1_init(&hmac->inner);
+        mbedtls_sha1_init(&hmac->outer);
+        memset(pad, 0x36, sizeof(pad));
+        for (size_t i = 0; i < KEY_SIZE; i++) {
+            pad[i] ^= otp_config->aes_key[i];
+        }
+        int ret = mbedtls_sha1_starts(&hmac->inner);
+        if (ret == 0) {
+            ret = mbedtls_sha1_update(&hmac->inner, pad, sizeof(pad));
+        }
+        for (size_t i = 0; i < sizeof(pad); i++) {
+            pad[i] ^= 0x36 ^ 0x5c;
+        }
+        if (ret == 0) {
+            ret = mbedtls_sha1_starts(&hmac->outer);
+        }
+        if (ret == 0) {
+            ret = mbedtls_sha1_update(&hmac->outer, pad, sizeof(pad));
+        }
+        mbedtls_platform_zeroize(pad, sizeof(pad));
+        if (ret != 0) {
+            mbedtls_sha1_free(&hmac->inner);
+            mbedtls_sha1_free(&hmac->outer);
+            return NULL;
+        }
+        otp_hmac_valid[slot - 1] = true;
+    }
+    return hmac;
+}
+
+static int otp_hmac_sha1(otp_hmac_ctx_t *hmac, const uint8_t *challenge, size_t challenge_len, uint8_t *out) {
+    mbedtls_sha1_context ctx;
+    mbedtls_sha1_init(&ctx);
+    mbedtls_sha1_clone(&ctx, &hmac->inner);
+    int ret = mbedtls_sha1_update(&ctx, challenge, challenge_len);
+    if (ret == 0) {
+        ret = mbedtls_sha1_finish(&ctx, out);
+    }
+    if (ret == 0) {
+        mbedtls_sha1_clone(&ctx, &hmac->outer);
+        ret = mbedtls_sha1_update(&ctx, out, 20);
+    }
+    if (ret == 0) {
+        ret = mbedtls_sha1_finish(&ctx, out);
+    }
+    mbedtls_sha1_free(&ctx);
+    return ret;
+}
+
 void init_otp() {
+    otp_keys_invalidate(1);
+    otp_keys_invalidate(2);
     if (scanned == false) {
         scan_all();
         for (uint8_t i = 0; i < 2; i++) {
@@ -101,6 +200,9 @@ void init_otp() {
                     file_put_data(ef, new_data, sizeof(new_data));
                 }
             }
+            if (file_has_data(ef)) {
+                otp_aes_get(i + 1, (const otp_config_t *) file_get_data(ef));
+            }
         }
         scanned = true;
         low_flash_available();
@@ -224,11 +326,13 @@ int otp_button_pressed(uint8_t slot) {
         crc = calculate_crc(otpk + 6, 14);
         *po++ = ~crc & 0xff;
         *po++ = ~crc >> 8;
-        mbedtls_aes_context ctx;
-        mbedtls_aes_init(&ctx);
-        mbedtls_aes_setkey_enc(&ctx, otp_config->aes_key, 128);
-        mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, otpk + 6, otpk + 6);
-        mbedtls_aes_free(&ctx);
+        mbedtls_aes_context *ctx = otp_aes_get(slot, otp_config);
+        if (ctx == NULL) {
+            return 1;
+        }
+        if (mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_ENCRYPT, otpk + 6, otpk + 6) != 0) {
+            return 1;
+        }
         uint8_t otp_out[44];
         encode_modhex(otpk, sizeof(otpk), otp_out);
         add_keyboard_buffer((const uint8_t *) otp_out, sizeof(otp_out), true);
@@ -266,6 +370,8 @@ INITIALIZER( otp_ctor ) {
 }
 
 int otp_unload() {
+    otp_keys_invalidate(1);
+    otp_keys_invalidate(2);
     return PICOKEY_OK;
 }
 
@@ -301,6 +407,7 @@ int cmd_otp() {
     if (p1 == 0x01 || p1 == 0x03) { // Configure slot
         otp_config_t *odata = (otp_config_t *) apdu.data;
         file_t *ef = file_new(p1 == 0x01 ? EF_OTP_SLOT1 : EF_OTP_SLOT2);
+        otp_keys_invalidate(p1 == 0x01 ? 1 : 2);
         if (file_has_data(ef)) {
             otp_config_t *otpc = (otp_config_t *) file_get_data(ef);
             if (memcmp(otpc->acc_code, apdu.data + otp_config_size, ACC_CODE_SIZE) != 0) {
@@ -320,7 +427,7 @@ int cmd_otp() {
             }
         }
         // Delete slot
-        delete_file(ef);
+        slot_delete_file(ef);
         if (!file_has_data(search_dynamic_file(EF_OTP_SLOT1)) &&
             !file_has_data(search_dynamic_file(EF_OTP_SLOT2))) {
             config_seq = 0;
@@ -332,6 +439,7 @@ int cmd_otp() {
         if (odata->rfu[0] != 0 || odata->rfu[1] != 0 || check_crc(odata) == false) {
             return SW_WRONG_DATA();
         }
+        otp_keys_invalidate(p1 == 0x04 ? 1 : 2);
         file_t *ef = search_dynamic_file(p1 == 0x04 ? EF_OTP_SLOT1 : EF_OTP_SLOT2);
         if (file_has_data(ef)) {
             otp_config_t *otpc = (otp_config_t *) file_get_data(ef);
@@ -346,13 +454,19 @@ int cmd_otp() {
                                (odata->tkt_flags & TKTFLAG_UPDATE_MASK);
             odata->cfg_flags = (otpc->cfg_flags & ~CFGFLAG_UPDATE_MASK) |
                                (odata->cfg_flags & CFGFLAG_UPDATE_MASK);
-            file_put_data(ef, apdu.data, otp_config_size);
+            memset(apdu.data + otp_config_size, 0, 8);
+            if (file_get_size(ef) >= otp_config_size + 8) { // Keep the counter
+                memcpy(apdu.data + otp_config_size, file_get_data(ef) + otp_config_size, 8);
+            }
+            file_put_data(ef, apdu.data, otp_config_size + 8);
             low_flash_available();
         }
     }
     else if (p1 == 0x06) {
         uint8_t tmp[otp_config_size + 8];
         bool ef1_data = false;
+        otp_keys_invalidate(1);
+        otp_keys_invalidate(2);
         file_t *ef1 = file_new(EF_OTP_SLOT1);
         file_t *ef2 = file_new(EF_OTP_SLOT2);
         if (file_has_data(ef1)) {
@@ -363,13 +477,13 @@ int cmd_otp() {
             file_put_data(ef1, file_get_data(ef2), file_get_size(ef2));
         }
         else {
-            delete_file(ef1);
+            slot_delete_file(ef1);
         }
         if (ef1_data) {
             file_put_data(ef2, tmp, sizeof(tmp));
         }
         else {
-            delete_file(ef2);
+            slot_delete_file(ef2);
         }
         low_flash_available();
     }
@@ -389,12 +503,11 @@ int cmd_otp() {
             }
             int ret = 0;
             if (p1 == 0x30 || p1 == 0x38) {
-                mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA1),
-                                otp_config->aes_key,
-                                KEY_SIZE,
-                                apdu.data,
-                                8,
-                                res_APDU);
+                otp_hmac_ctx_t *hmac = otp_hmac_get(p1 == 0x30 ? 1 : 2, otp_config);
+                if (hmac == NULL) {
+                    return SW_EXEC_ERROR();
+                }
+                ret = otp_hmac_sha1(hmac, apdu.data, 8, res_APDU);
                 if (ret == 0) {
                     res_APDU_size = 20;
                 }
@@ -403,11 +516,11 @@ int cmd_otp() {
                 uint8_t challenge[16];
                 memcpy(challenge, apdu.data, 6);
                 memcpy(challenge + 6, pico_serial_str, 10);
-                mbedtls_aes_context ctx;
-                mbedtls_aes_init(&ctx);
-                mbedtls_aes_setkey_enc(&ctx, otp_config->aes_key, 128);
-                ret = mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, challenge, res_APDU);
-                mbedtls_aes_free(&ctx);
+                mbedtls_aes_context *ctx = otp_aes_get(p1 == 0x20 ? 1 : 2, otp_config);
+                if (ctx == NULL) {
+                    return SW_EXEC_ERROR();
+                }
+                ret = mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_ENCRYPT, challenge, res_APDU);
                 if (ret == 0) {
                     res_APDU_size = 16;
                 }
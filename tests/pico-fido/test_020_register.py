@@ -24,6 +24,7 @@ import fido2.features
 fido2.features.webauthn_json_mapping.enabled = False
 from utils import ES256K
 import pytest
+import os
 
 
 def test_register(device):
@@ -192,6 +193,15 @@ def test_exclude_list_excluded(device):
 
     assert e.value.code == CtapError.ERR.CREDENTIAL_EXCLUDED
 
+def test_long_exclude_list_excluded(device):
+    res = device.doMC()['res'].attestation_object
+    exclude_list = [{"id": os.urandom(64), "type": "public-key"} for _ in range(32)]
+    exclude_list.append({"id": res.auth_data.credential_data.credential_id, "type": "public-key"})
+    with pytest.raises(CtapError) as e:
+        device.doMC(exclude_list=exclude_list)
+
+    assert e.value.code == CtapError.ERR.CREDENTIAL_EXCLUDED
+
 def test_unknown_option(device):
     device.reset()
     device.MC(options={"unknown": False})
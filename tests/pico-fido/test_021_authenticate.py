@@ -22,6 +22,7 @@ from fido2.client import CtapError
 from fido2.cose import ES256, ES384, ES512
 from utils import verify, ES256K
 import pytest
+import hashlib
 
 def test_authenticate(device):
     device.reset()
@@ -59,6 +60,21 @@ def test_algorithms(device, info, alg):
         ])
         verify(MCRes['res'].attestation_object, res['res'], res['req']['client_data_hash'])
 
+@pytest.mark.parametrize(
+    "rp_id_len", [1, 55, 56, 63, 64, 65, 119, 120, 128]
+)
+def test_rp_id_hash_block_boundaries(device, rp_id_len):
+    """ Digests around the SHA-256 padding boundaries match on every hash backend """
+    rp_id = 'a' * rp_id_len
+    MCRes = device.MC(rp={"id": rp_id, "name": rp_id})
+    res = device.GA(rp_id=rp_id, allow_list=[
+        {"id": MCRes['res'].auth_data.credential_data.credential_id, "type": "public-key"}
+    ])
+    rp_id_hash = hashlib.sha256(rp_id.encode()).digest()
+    assert MCRes['res'].auth_data.rp_id_hash == rp_id_hash
+    assert res['res'].auth_data.rp_id_hash == rp_id_hash
+    verify(MCRes['res'], res['res'], res['req']['client_data_hash'])
+
 def test_get_assertion_allow_list_filtering_and_buffering(device):
     """ Check that authenticator filters and stores items in allow list correctly """
     allow_list = []
@@ -227,6 +227,48 @@ def test_add_delete(device):
     res = credMgmt.enumerate_creds(regs[0].auth_data.rp_id_hash)
     assert len(res) == 2
 
+def test_delete_middle_multiple_rps(device, client_pin_set):
+    """ Deleting resident credentials moves the files behind them in the dynamic
+    table. The remaining ones, of every RP, must still enumerate with their ids. """
+
+    rps = [{"id": f"example_del_{i}.com", "name": f"RP {i}"} for i in range(3)]
+    ids = {rp["id"]: [] for rp in rps}
+
+    # interleave the RPs, so the files of each one are spread over the table
+    for i in range(0, 3):
+        for rp in rps:
+            reg = device.doMC(rp=rp, rk=True, user=generate_random_user())['res'].attestation_object
+            ids[rp["id"]].append(reg.auth_data.credential_data.credential_id)
+
+    def check(credMgmt):
+        assert len(credMgmt.enumerate_rps()) == len(rps)
+        for rp in rps:
+            creds = credMgmt.enumerate_creds(sha256(rp["id"].encode()))
+            assert sorted(c[7]["id"] for c in creds) == sorted(ids[rp["id"]])
+
+    credMgmt = CredMgmt(device)
+    check(credMgmt)
+
+    # middle credential of the middle RP, then the first one of the first RP
+    for rp_id, n in ((rps[1]["id"], 1), (rps[0]["id"], 0)):
+        cred_id = ids[rp_id].pop(n)
+        credMgmt.delete_cred({"id": cred_id, "type": "public-key"})
+        check(credMgmt)
+
+def test_long_user_fields(device, client_pin_set):
+    """ user.name and displayName longer than 64 bytes are truncated, not rejected. """
+
+    rp = {"id": "example_5.com", "name": "John Doe 4"}
+    # 3-byte UTF-8 characters, so the 64-byte cut falls inside the 22nd one
+    user = {"id": b"long_user", "name": "n" * 300, "displayName": "\u20ac" * 100}
+    reg = device.doMC(rp=rp, rk=True, user=user)['res'].attestation_object
+
+    credMgmt = CredMgmt(device)
+    creds = credMgmt.enumerate_creds(reg.auth_data.rp_id_hash)
+    assert len(creds) == 1
+    assert creds[0][CredentialManagement.RESULT.USER]["name"] == "n" * 64
+    assert creds[0][CredentialManagement.RESULT.USER]["displayName"] == "\u20ac" * 21
+
 def test_multiple_creds_per_multiple_rps(
     device, MC_RK_Res
 ):
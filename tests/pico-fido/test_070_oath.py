@@ -66,6 +66,30 @@ def list_apdu(ccid_card):
     resp = send_apdu(ccid_card, INS_LIST, p1=0, p2=0)
     return resp
 
+def send_apdu_remaining(ccid_card, command, p1, p2, data=None):
+    """ Sends an APDU and collects the 61xx continuations with SEND REMAINING """
+    apdu = [0x00, command, p1, p2]
+    if (data):
+        apdu += [0x00] + list(len(data).to_bytes(2, 'big')) + data
+    apdu += [0x00, 0x00]
+    resp = []
+    while True:
+        r, sw1, sw2 = ccid_card.connection.transmit(apdu)
+        resp += r
+        if (sw1 != RESP_MORE_DATA):
+            break
+        apdu = [0x00, INS_SEND_REMAINING, 0x00, 0x00, 0x00, 0x00]
+    if (sw1 != 0x90):
+        raise APDUResponse(sw1, sw2)
+    return resp
+
+def parse_tlv(data):
+    tlv = []
+    while (len(data) > 0):
+        tlv.append((data[0], data[2:2+data[1]]))
+        data = data[2+data[1]:]
+    return tlv
+
 name_kaka = [ord('k'), ord('a'), ord('k'), ord('a')]
 data_name = [TAG_NAME] + [len(name_kaka)] + name_kaka
 data_key = [TAG_KEY, 0x16, 0x21, 0x06, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b]
@@ -193,6 +217,68 @@ def test_imf_more(reset_oath):
     exp = [TAG_T_RESPONSE, 5, 6, 0x41, 0x39, 0x7e, 0xea]
     assert(exp == resp)
 
+def test_imf_separate(reset_oath):
+    # RFC 4226 appendix D
+    key = list(bytes(b'12345678901234567890'))
+    codes = [755224, 287082, 359152, 969429]
+    names = [list(bytes(b'first')), list(bytes(b'second'))]
+
+    def hotp(name):
+        data = [TAG_NAME, len(name)] + name + [TAG_CHALLENGE]
+        resp = send_apdu(reset_oath, INS_CALCULATE, p1=0, p2=1, data=data)
+        assert(resp[:3] == [TAG_T_RESPONSE, 5, 6])
+        return int.from_bytes(bytes(resp[3:7]), 'big') % 10**6
+
+    for name in names:
+        data = [TAG_NAME, len(name)] + name + [TAG_KEY, len(key)+2, ALG_SHA1 | TYPE_HOTP, 6] + key
+        send_apdu(reset_oath, INS_PUT, p1=0, p2=0, data=data)
+    assert([hotp(names[0]) for _ in range(3)] == codes[:3])
+    assert(hotp(names[1]) == codes[0])
+    assert(hotp(names[0]) == codes[3])
+
+    # A new credential does not inherit the counter of a deleted one
+    send_apdu(reset_oath, INS_DELETE, p1=0, p2=0, data=[TAG_NAME, len(names[0])] + names[0])
+    name = list(bytes(b'third'))
+    data = [TAG_NAME, len(name)] + name + [TAG_KEY, len(key)+2, ALG_SHA1 | TYPE_HOTP, 6] + key
+    send_apdu(reset_oath, INS_PUT, p1=0, p2=0, data=data)
+    assert(hotp(name) == codes[0])
+    assert(hotp(names[1]) == codes[1])
+
+# RFC 6238 appendix B, HMAC-SHA256
+totp_sha256_vectors = [
+    (59, 46119246),
+    (1111111109, 68084774),
+    (1111111111, 67062674),
+    (1234567890, 91819424),
+    (2000000000, 90698825),
+    (20000000000, 77737706),
+]
+
+@pytest.mark.parametrize("t, code", totp_sha256_vectors)
+def test_totp_sha256_vectors(reset_oath, t, code):
+    key = list(bytes(b'12345678901234567890123456789012'))
+    name = list(bytes(b'sha256'))
+    data = [TAG_NAME, len(name)] + name + [TAG_KEY, len(key)+2, ALG_SHA256 | TYPE_TOTP, 8] + key
+    resp = send_apdu(reset_oath, INS_PUT, p1=0, p2=0, data=data)
+    chal = list((t // 30).to_bytes(8, 'big'))
+    data = [TAG_NAME, len(name)] + name + [TAG_CHALLENGE, len(chal)] + chal
+    resp = send_apdu(reset_oath, INS_CALCULATE, p1=0, p2=1, data=data)
+    assert(resp[:3] == [TAG_T_RESPONSE, 5, 8])
+    assert(int.from_bytes(bytes(resp[3:7]), 'big') % 10**8 == code)
+
+# Key and message lengths around the SHA-256 block and padding boundaries,
+# kept below 0x80 so the TLV lengths fit in one byte
+@pytest.mark.parametrize("key_len, chal_len", [(1, 1), (32, 55), (63, 56), (64, 64), (65, 119), (100, 120), (125, 127)])
+def test_hmac_sha256_lengths(reset_oath, key_len, chal_len):
+    key = [(i * 31 + 7) & 0xff for i in range(key_len)]
+    chal = [(i * 13 + 1) & 0xff for i in range(chal_len)]
+    name = list(bytes(b'sha256'))
+    data = [TAG_NAME, len(name)] + name + [TAG_KEY, len(key)+2, ALG_SHA256 | TYPE_TOTP, 8] + key
+    resp = send_apdu(reset_oath, INS_PUT, p1=0, p2=0, data=data)
+    data = [TAG_NAME, len(name)] + name + [TAG_CHALLENGE, len(chal)] + chal
+    resp = send_apdu(reset_oath, INS_CALCULATE, p1=0, p2=0, data=data)
+    assert(resp == [TAG_RESPONSE, 33, 8] + list(hmac.digest(bytes(key), bytes(chal), 'sha256')))
+
 def test_delete(reset_oath):
     key = list(bytes(b'blahonga!'))
     firstname = list(bytes(b'one'))
@@ -217,9 +303,66 @@ def test_delete(reset_oath):
     data = [TAG_NAME, len(thirdname)] + thirdname + [TAG_KEY, len(key)+2, type, 6] + key
     resp = send_apdu(reset_oath, INS_PUT, p1=0, p2=0, data=data)
     resp = list_apdu(reset_oath)
-    exp = [TAG_NAME_LIST, len(thirdname)+1, type] + thirdname + [TAG_NAME_LIST, len(secondname)+1, type] + secondname
+    exp = [TAG_NAME_LIST, len(secondname)+1, type] + secondname + [TAG_NAME_LIST, len(thirdname)+1, type] + thirdname
     assert(exp == resp)
 
+def test_many_creds(reset_oath):
+    key = list(bytes(b'blahonga!'))
+    type = ALG_SHA1 | TYPE_TOTP
+    for i in range(300):
+        name = list(bytes(f'account{i:03d}', 'ascii'))
+        data = [TAG_NAME, len(name)] + name + [TAG_KEY, len(key)+2, type, 6] + key
+        send_apdu(reset_oath, INS_PUT, p1=0, p2=0, data=data)
+
+    names = [list(bytes(f'account{i:03d}', 'ascii')) for i in range(300)]
+    resp = parse_tlv(send_apdu_remaining(reset_oath, INS_LIST, p1=0, p2=0))
+    assert(resp == [(TAG_NAME_LIST, [type] + name) for name in names])
+
+    resp = parse_tlv(send_apdu_remaining(reset_oath, INS_CALC_ALL, p1=0, p2=1, data=data_chal))
+    assert(len(resp) == 2 * len(names))
+    assert([v for t, v in resp[0::2]] == names)
+    code = hmac.digest(bytes(key), bytes(data_chal[2:]), 'sha1')
+    offset = code[-1] & 0x0f
+    exp = [6, code[offset] & 0x7f] + list(code[offset+1:offset+4])
+    assert(all(r == (TAG_T_RESPONSE, exp) for r in resp[1::2]))
+
+    name = list(bytes(b'account299'))
+    data = [TAG_NAME, len(name)] + name + data_chal
+    resp = send_apdu(reset_oath, INS_CALCULATE, p1=0, p2=1, data=data)
+    assert(resp[:3] == [TAG_T_RESPONSE, 5, 6])
+
+    data = [TAG_NAME, len(name)] + name
+    resp = send_apdu(reset_oath, INS_DELETE, p1=0, p2=0, data=data)
+    data = [TAG_NAME, len(name)] + name + data_chal
+    with pytest.raises(APDUResponse) as e:
+        resp = send_apdu(reset_oath, INS_CALCULATE, p1=0, p2=1, data=data)
+    assert([e.value.sw1, e.value.sw2] == [0x69, 0x84])
+
+def test_full_store(reset_oath):
+    key = list(range(32))
+    type = ALG_SHA256 | TYPE_TOTP
+    # 128-byte records (4-byte header, 90-byte name and 34-byte key), 16 per page
+    for i in range(512):
+        name = list(bytes(f'{i:03d}'.ljust(90, '.'), 'ascii'))
+        data = [TAG_NAME, len(name)] + name + [TAG_KEY, len(key)+2, type, 6] + key
+        send_apdu(reset_oath, INS_PUT, p1=0, p2=0, data=data)
+
+    name = list(bytes(b'one too many'))
+    data = [TAG_NAME, len(name)] + name + [TAG_KEY, len(key)+2, type, 6] + key
+    with pytest.raises(APDUResponse) as e:
+        resp = send_apdu(reset_oath, INS_PUT, p1=0, p2=0, data=data)
+    assert([e.value.sw1, e.value.sw2] == [0x6a, 0x84])
+
+    # Overwriting a credential of a full store keeps it when the new one does not fit
+    name = list(bytes(f'{0:03d}'.ljust(90, '.'), 'ascii'))
+    data = [TAG_NAME, len(name)] + name + [TAG_KEY, 0x7f, type, 6] + list(range(125))
+    with pytest.raises(APDUResponse) as e:
+        resp = send_apdu(reset_oath, INS_PUT, p1=0, p2=0, data=data)
+    assert([e.value.sw1, e.value.sw2] == [0x6a, 0x84])
+    data = [TAG_NAME, len(name)] + name + data_chal
+    resp = send_apdu(reset_oath, INS_CALCULATE, p1=0, p2=1, data=data)
+    assert(resp[:3] == [TAG_T_RESPONSE, 5, 6])
+
 def test_noauth(reset_oath):
     key = list(bytes(b'kaka blahonga'))
     chal = [1,2,3,4,5,6,7,8]
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+/*
+ * This file is part of the Pico Fido distribution (https://github.com/polhenarejos/pico-fido).
+ * Copyright (c) 2022 Pol Henarejos.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+"""
+
+# find_app_by_rp_id_hash() does a binary search over kapps[], so the table
+# in src/fido/known_apps.c must be sorted by rp_id_hash. Run this script after
+# adding entries to re-sort it in place, or with --check to only verify it.
+
+import sys
+import re
+import argparse
+import os
+
+KAPPS_START = 'static const known_app_t kapps[] = {\n'
+KAPPS_END = '};\n'
+
+def entry_hash(entry):
+    m = re.search(r'"((?:\\x[0-9a-fA-F]{2}){32})"', entry)
+    if m is None:
+        return None
+    return bytes.fromhex(m.group(1).replace('\\x', ''))
+
+def split_entries(body):
+    entries, depth, cur = [], 0, ''
+    for line in body.splitlines(keepends=True):
+        if depth == 0 and line.strip() == '':
+            continue
+        cur += line
+        depth += line.count('{') - line.count('}')
+        if depth == 0:
+            entries.append(cur)
+            cur = ''
+    return entries
+
+def main(args):
+    with open(args.file, 'r') as f:
+        src = f.read()
+    start = src.index(KAPPS_START) + len(KAPPS_START)
+    end = src.index(KAPPS_END, start)
+    entries = split_entries(src[start:end])
+    apps = [e for e in entries if entry_hash(e) is not None]
+    sentinel = [e for e in entries if entry_hash(e) is None]
+    if len(sentinel) != 1:
+        print('Expected exactly one NULL terminator in kapps[]')
+        return 1
+    hashes = [entry_hash(e) for e in apps]
+    if len(set(hashes)) != len(hashes):
+        print('Duplicated rp_id_hash in kapps[]')
+        return 1
+    sorted_apps = sorted(apps, key=entry_hash)
+    if args.check:
+        if sorted_apps != apps:
+            print('kapps[] is not sorted by rp_id_hash. Run tools/sort_known_apps.py')
+            return 1
+        return 0
+    body = ''.join(e if e.rstrip('\n').endswith(',') else e.rstrip('\n') + ',\n' for e in sorted_apps) + sentinel[0]
+    with open(args.file, 'w') as f:
+        f.write(src[:start] + body + src[end:])
+    print(f'Sorted {len(sorted_apps)} entries')
+    return 0
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='Sorts the known apps table by rp_id_hash')
+    parser.add_argument('--check', help='Only check that the table is sorted', action='store_true')
+    parser.add_argument('file', nargs='?', help='Path to known_apps.c',
+                        default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'src', 'fido', 'known_apps.c'))
+    return parser.parse_args()
+
+if __name__ == '__main__':
+    sys.exit(main(parse_args()))